@@ -1,15 +1,34 @@
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <malloc.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <time.h>
+#include <unistd.h>
 
 #define false 0
 #define true 1
 #define null 0
 #define INPUT_CHAR '>'
 #define BOARD_SIZE 9
-#define TIMEOUT 5
+#define ROW_RETRY_LIMIT 20
 #define NUMBER_SPACING 1
 #define EASY_REMOVE 20
 #define MED_REMOVE 26
@@ -26,8 +45,46 @@
 #define ASCII_LETTER_DIFF 65
 #define SPACE_VAL 32
 #define BASE_SCORE 1000
-#define SAVE_N_CMP 5
+#define MOVE_INPUT_SIZE 256
+#define MAX_BATCH_MOVES 81
+#define NUM_PEERS 20
+#define NOTE_CELL_WIDTH 5
 #define CIPHER_OFFSET 30
+#define MAX_BOX_SIZE 4
+#define MAX_GRID_SIZE (MAX_BOX_SIZE * MAX_BOX_SIZE)
+#define MAX_GRID_CELLS (MAX_GRID_SIZE * MAX_GRID_SIZE)
+#define MAX_GRID_UNITS (MAX_GRID_SIZE * 3 + 4)
+#define MAX_CELL_UNITS 5
+#define MAX_PEERS 48
+#define CLASSIC_PEERS_PER_CELL (2 * (BOARD_SIZE - 1) + (BOARD_SIZE / 3 - 1) * (BOARD_SIZE / 3 - 1))
+#define SPLIT_DEPTH 6
+#define FILL_ATTEMPT_BUDGET 2000
+#define DEQUE_CAPACITY 4096
+#define PUZZLE_LINE_SIZE 512
+#define SESSION_LINE_SIZE 256
+#define READ_CHUNK_SIZE 4096
+#define MAX_EVENTS 256
+#define DEFAULT_POOL_SIZE 32
+#define MAX_SESSION_BACKLOG (64 * 1024)
+#define LATENCY_BUCKETS 40
+#define HISTOGRAM_WIDTH 40
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 8
+#define PACK_TRAILER_SIZE 20
+#define PACK_BLOCK_PUZZLES 256
+#define PACK_BITMAP_BYTES ((BOARD_SIZE * BOARD_SIZE + 7) / 8)
+#define PACK_RECORD_MAX (PACK_BITMAP_BYTES + (BOARD_SIZE * BOARD_SIZE + 1) / 2)
+#define PACK_IO_BUFFER_SIZE (1 << 20)
+#define TOP_SCORES 10
+#define SCORE_TABLE_MIN_CAPACITY 1024
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define SAVE_VERSION 1
+#define SAVE_BOARD_BYTES ((BOARD_SIZE * BOARD_SIZE + 1) / 2)
+#define SAVE_BINARY_SIZE (20 + 2 * SAVE_BOARD_BYTES + 4)
+#define SAVE_DETAIL_SIZE 128
+#define CRC32_POLYNOMIAL 0xEDB88320u
+#define COMMAND_FAILED 2
 
 typedef int bool;
 
@@ -37,8 +94,10 @@ char ROW_NAMES[BOARD_SIZE] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
 char *MAIN_MENU_TITLE = "Please select an option from the list below";
 const char *MAIN_MENU_OPTIONS[] = {"Start a new game",
                                    "Load game",
+                                   "Load puzzle",
+                                   "High scores",
                                    "Exit"};
-int MAIN_MENU_SIZE = 3;
+int MAIN_MENU_SIZE = 5;
 
 const char *DIFFICULTY_MENU_OPTIONS[] = {"Easy",
                                          "Medium",
@@ -46,15 +105,52 @@ const char *DIFFICULTY_MENU_OPTIONS[] = {"Easy",
 int DIFFICULTY_MENU_SIZE = 3;
 char *DIFFICULTY_MENU_TITLE = "Choose a difficulty";
 
+const char *VARIANT_MENU_OPTIONS[] = {"Classic",
+                                      "Diagonal (X)",
+                                      "Hyper",
+                                      "Jigsaw"};
+const char *VARIANT_NAMES[] = {"classic", "diagonal", "hyper", "jigsaw"};
+int VARIANT_MENU_SIZE = 4;
+char *VARIANT_MENU_TITLE = "Choose a variant";
+
+// Marks the start of a packed puzzle file and of its block index
+const char *PACK_MAGIC = "CDKP";
+const char *PACK_INDEX_MAGIC = "CDKI";
+
+// Every finished game is appended to the score log. The index file keeps
+// the top scores and each puzzle's best so they can be found without
+// reading the log
+const char *SCORE_FILE_PREFIX = "cdoku_scores";
+const char *SCORE_LOG_FILE = "cdoku_scores.log";
+const char *SCORE_INDEX_FILE = "cdoku_scores.idx";
+const char *SCORE_INDEX_MAGIC = "CDKS";
+
+// Marks a save written in the binary format
+const char *SAVE_MAGIC = "CDKG";
+
+// Regions that take the place of the boxes in jigsaw games
+const char *JIGSAW_LAYOUT = "AAAABBBCC"
+                            "AAABBBCCC"
+                            "DABBBCCCC"
+                            "DADEEEEFF"
+                            "DDDEEEFFF"
+                            "DDDEEFFFF"
+                            "GGGGHIIII"
+                            "GGGHHHIII"
+                            "GGHHHHHII";
+
 const char * HELP = "help";
 const char * HELP_MSG = "How to play:\n\n"
-                        "\tNOTE: Commands are case and whitespace sensitive\n\n"
+                        "\tNOTE: Commands are not case sensitive\n\n"
                         "\tCommands:\n"
                         "\t  1A 1:              This is how to make moves. The 1A indicates\n"
                         "\t                     the square to be changed and the value after\n"
                         "\t                     is the value to change it to. In this example\n"
                         "\t                     the value in row 1, column A, is changed\n"
                         "\t                     to the value of 1\n"
+                        "\t  1A 1; 2B 3:        Makes several moves at once. If checking\n"
+                        "\t                     stops a move, the moves before it are kept\n"
+                        "\t  1A 0:              Clears the value in row 1, column A\n"
                         "\t  help:              Displays this message\n"
                         "\t  save FILENAME:     Saves game to output file name provided\n"
                         "\t  hint:              Returns a hint (affects score)\n"
@@ -62,8 +158,11 @@ const char * HELP_MSG = "How to play:\n\n"
                         "\t                     feature that tells you if a move violates\n"
                         "\t                     the rules of sudoku and thus prevents you\n"
                         "\t                     from making it (affects score)\n"
+                        "\t  notes {on|off}:    Shows or hides the values each empty square\n"
+                        "\t                     can still take\n"
                         "\t  quit:              Quits game without saving\n";
 
+const char * COMMAND_PROMPT = "\nEnter a command. Type 'help' for how to play:\n\n";
 const char * WIN_MESSAGE = "Congratulations, you completed the sudoku correctly!";
 const char * SCORE_MESSAGE = "Score is based on difficulty, checks, hints, and time.";
 const char * FULL_BUT_INCORRECT = "The board is full but there are errors.";
@@ -73,6 +172,8 @@ int const BOX_SIZE = BOARD_SIZE / 3;
 enum mainEnum{
     NewGame = 1,
     LoadGame,
+    LoadPuzzle,
+    HighScores,
     Exit
 };
 
@@ -82,6 +183,13 @@ enum difficultyEnum{
     Hard
 };
 
+enum variantEnum{
+    Classic = 1,
+    Diagonal,
+    Hyper,
+    Jigsaw
+};
+
 enum moveTypeEnum{
     Move,
     Help,
@@ -89,15 +197,40 @@ enum moveTypeEnum{
     Hint,
     Check,
     Check_Toggle,
+    Notes_Toggle,
     Save,
     Error
 };
 
+typedef struct ParsedMove{
+    unsigned char row;
+    unsigned char col;
+    unsigned char value;
+} ParsedMove;
+
+// A line of input broken down by parseCommand
+typedef struct Command{
+    enum moveTypeEnum type;
+    bool toggleOn;
+    int numMoves;
+    ParsedMove moves[MAX_BATCH_MOVES];
+    const char *name;
+    int nameLength;
+} Command;
+
 typedef struct BuildValue{
     int value;
     struct BuildValue *next;
 } BuildValue;
 
+// Pencil marks for every cell. Bit v of a cell's candidates is set while no
+// peer (a cell sharing its row, column, or box) holds the value v. blockers
+// counts the peers holding each value so a clear can be undone exactly
+typedef struct Notes{
+    unsigned short candidates[BOARD_SIZE * BOARD_SIZE];
+    unsigned char blockers[BOARD_SIZE * BOARD_SIZE][BOARD_SIZE + 1];
+} Notes;
+
 typedef struct GameStats{
     bool checksOn;
     int elapsedTime;
@@ -105,10 +238,483 @@ typedef struct GameStats{
     int numChecks;
     int difficulty;
     time_t startTime;
+    bool notesOn;
+    Notes *notes;
+    int variant;
 } GameStats;
 
-// Check whether a move violates the constraints of a winning sudoku board
+// A save read back by readSaveFile. error says what was wrong with it
+typedef struct SaveFile{
+    int **board;
+    int **solutionBoard;
+    GameStats stats;
+    bool binary;
+    long size;
+    const char *error;
+} SaveFile;
+
+// The units (groups of cells that must each hold every value once) of a
+// variant. Units 0 to size - 1 are the rows, then the columns, then the boxes
+// or jigsaw regions, then any extra units such as diagonals. The classic
+// flag means the units can be worked out from a cell's position instead of
+// looked up
+typedef struct Ruleset{
+    bool classic;
+    int boxSize;
+    int size;
+    int numCells;
+    int numUnits;
+    unsigned char units[MAX_GRID_UNITS][MAX_GRID_SIZE];
+    unsigned char numCellUnits[MAX_GRID_CELLS];
+    unsigned char cellUnits[MAX_GRID_CELLS][MAX_CELL_UNITS];
+    unsigned char numPeers[MAX_GRID_CELLS];
+    unsigned char peers[MAX_GRID_CELLS][MAX_PEERS];
+} Ruleset;
+
+// Bitmask solver state for a grid of boxSize^2 x boxSize^2 cells. Bit v of a
+// unit's mask is set when the value v is already placed in that unit
+typedef struct Solver{
+    const Ruleset *rules;
+    int boxSize;
+    int size;
+    int numCells;
+    int depth;
+    unsigned int unitMask[MAX_GRID_UNITS];
+    unsigned char cells[MAX_GRID_CELLS];
+} Solver;
+
+// Fixed capacity Chase-Lev work-stealing deque. The owning thread pushes and
+// pops at the bottom while other threads steal from the top
+typedef struct TaskDeque{
+    atomic_long top;
+    atomic_long bottom;
+    Solver *_Atomic tasks[DEQUE_CAPACITY];
+} TaskDeque;
+
+typedef struct ParallelSearch{
+    int numThreads;
+    long limit;
+    atomic_long found;
+    atomic_long pending;
+    atomic_int cancel;
+    TaskDeque *deques;
+} ParallelSearch;
+
+enum symmetryEnum{
+    No_Symmetry,
+    Rotational,
+    Mirror
+};
+
+// Work shared by the threads of 'cdoku generate'
+typedef struct GenerateJob{
+    atomic_int remaining;
+    const Ruleset *rules;
+    enum symmetryEnum symmetry;
+} GenerateJob;
+
+// A board being generated in the background for a difficulty the player
+// may pick next
+typedef struct Speculation{
+    pthread_t thread;
+    int difficulty;
+    bool running;
+    atomic_int done;
+    atomic_int cancel;
+    unsigned int seed;
+    int **board;
+    int **solutionBoard;
+} Speculation;
+
+typedef struct SearchWorker{
+    ParallelSearch *search;
+    int id;
+    unsigned int seed;
+} SearchWorker;
+
+typedef struct SubCommand{
+    const char *name;
+    int (*run)(int argc, char **argv);
+    const char *usage;
+} SubCommand;
+
+enum sessionStateEnum{
+    ChoosingDifficulty,
+    Playing,
+    Closing
+};
+
+// One connected player. Input is collected until a full line arrives and
+// output is queued until the socket can take it. events is the set the
+// session is registered with in epoll
+typedef struct Session{
+    int fd;
+    enum sessionStateEnum state;
+    int **board;
+    int **solutionBoard;
+    GameStats stats;
+    char input[SESSION_LINE_SIZE];
+    int inputLength;
+    bool discardingLine;
+    char *output;
+    size_t outputLength;
+    size_t outputSent;
+    size_t outputCapacity;
+    unsigned int events;
+} Session;
+
+// Boards generated up front for one difficulty and handed out round robin
+typedef struct PuzzlePool{
+    int size;
+    int next;
+    int ***boards;
+    int ***solutionBoards;
+} PuzzlePool;
+
+typedef struct GameServer{
+    int listenFd;
+    int epollFd;
+    int numSessions;
+    FILE *capture;
+    char *captureBuffer;
+    size_t captureLength;
+    PuzzlePool pools[3];
+} GameServer;
+
+// A simulated player used by the load generator
+typedef struct LoadClient{
+    int fd;
+    int commandsSent;
+    double sentAt;
+    char tail[2];
+    bool connected;
+} LoadClient;
+
+// What a simulated player does on a turn. Each gets its own latency histogram
+enum botActionEnum{
+    Bot_Correct,
+    Bot_Mistake,
+    Bot_Hint,
+    Bot_Check_Toggle,
+    Bot_Save,
+    Bot_Generate,
+    NUM_BOT_ACTIONS
+};
+
+// Counts of latencies falling in power of two buckets of nanoseconds.
+// Bucket b holds latencies from 2^b up to 2^(b+1) ns
+typedef struct LatencyHistogram{
+    long counts[LATENCY_BUCKETS];
+    long total;
+    double sumSeconds;
+    double maxSeconds;
+} LatencyHistogram;
+
+// A simulated player in the middle of a game
+typedef struct Bot{
+    int id;
+    int **board;
+    int **solutionBoard;
+    GameStats stats;
+    int gamesLeft;
+    int turns;
+} Bot;
+
+typedef struct Simulation{
+    int gamesPerBot;
+    int saveEvery;
+    int weights[3];
+    int totalWeight;
+    const char *saveDir;
+} Simulation;
+
+// A thread running its share of the bots, taking a turn for each in turn
+typedef struct SimWorker{
+    pthread_t thread;
+    Simulation *sim;
+    Bot *bots;
+    int numBots;
+    unsigned int seed;
+    long games;
+    long commands;
+    long totalScore;
+    long failedSaves;
+    LatencyHistogram histograms[NUM_BOT_ACTIONS];
+} SimWorker;
+
+// Writes a packed puzzle file. Puzzles are collected into blocks of
+// PACK_BLOCK_PUZZLES and each block is written out once it fills, so only
+// one block and the offsets of the earlier blocks are held in memory
+typedef struct PackWriter{
+    FILE *fp;
+    unsigned char block[PACK_BLOCK_PUZZLES * PACK_RECORD_MAX + 2];
+    int blockLength;
+    int blockPuzzles;
+    long long offset;
+    long long numPuzzles;
+    long long *blockOffsets;
+    int numBlocks;
+    int blockCapacity;
+} PackWriter;
+
+// Reads a packed puzzle file from the front, or from any puzzle after
+// seekPackedPuzzle has used the block index
+typedef struct PackReader{
+    FILE *fp;
+    int variant;
+    int puzzlesPerBlock;
+    int puzzlesLeftInBlock;
+    long long numPuzzles;
+} PackReader;
+
+enum saveResultEnum{
+    Save_Valid,
+    Save_Invalid,
+    Save_Migrated,
+    Save_Failed
+};
+
+// What cdoku saves found for one file
+typedef struct SaveReport{
+    char *name;
+    enum saveResultEnum result;
+    long bytesRead;
+    long bytesWritten;
+    char detail[SAVE_DETAIL_SIZE];
+} SaveReport;
+
+// A directory of saves being checked. Worker threads claim files in turn
+// through next
+typedef struct SaveScan{
+    const char *dir;
+    bool migrate;
+    SaveReport *reports;
+    int numReports;
+    atomic_int next;
+} SaveScan;
+
+// A finished game as stored in the score log. Records are a fixed size so
+// record n sits at n * sizeof(ScoreRecord)
+typedef struct ScoreRecord{
+    long long timestamp;
+    unsigned long long puzzleHash;
+    int score;
+    int seconds;
+    unsigned short numHints;
+    unsigned short numChecks;
+    unsigned char difficulty;
+    unsigned char variant;
+    unsigned char reserved[2];
+} ScoreRecord;
+
+typedef struct ScoreEntry{
+    long long record;
+    int score;
+    int reserved;
+} ScoreEntry;
+
+// A slot in the score index's open addressing table of per puzzle bests
+typedef struct PuzzleBest{
+    unsigned long long hash;
+    long long record;
+    int score;
+    int reserved;
+} PuzzleBest;
+
+// Finished games handed from the server's event loop to a thread that
+// writes them, so locking and updating the index never stalls other sessions
+typedef struct ScoreWriter{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    ScoreRecord *pending;
+    int numPending;
+    int capacity;
+    bool stopping;
+} ScoreWriter;
+
+// The start of the score index file. The table of puzzle bests follows it
+typedef struct ScoreIndexHeader{
+    char magic[4];
+    int numTop[3];
+    long long numRecords;
+    long long numPuzzles;
+    long long tableCapacity;
+    ScoreEntry top[3][TOP_SCORES];
+} ScoreIndexHeader;
+
+// Where the game writes its output. The interactive game leaves this null
+// to write to stdout, the server points it at the current session's buffer
+_Thread_local FILE *gameOut = null;
+
+FILE *gameOutput(){
+    return gameOut != null ? gameOut : stdout;
+}
+
+// Rulesets for each 9x9 variant, plus classic 16x16 for the solver
+Ruleset RULESETS[4];
+Ruleset LARGE_CLASSIC_RULES;
+pthread_once_t rulesetsOnce = PTHREAD_ONCE_INIT;
+
+// The peers of each square in a classic 9x9 game, copied from its ruleset.
+// Every square has the same number, so moveIsValidClassic's loop has a bound
+// known at compile time. main fills it in before starting anything else
+unsigned char CLASSIC_PEERS[BOARD_SIZE * BOARD_SIZE][CLASSIC_PEERS_PER_CELL];
+
+// The rules of the game being played on this thread. Null means classic
+_Thread_local const Ruleset *currentRules = null;
+
+// Whether games won on this thread go in the score log. Bots leave it off
+_Thread_local bool recordScores = false;
+
+// When set, games won on this thread are queued for the writer's thread
+// instead of being written before the turn finishes
+_Thread_local ScoreWriter *scoreWriter = null;
+
+// Random choices made during a game, such as where a hint looks first. Each
+// thread has its own so simulated players don't contend on rand's lock
+_Thread_local unsigned int gameSeed = 1;
+
+// Add a unit made up of the given cells
+void addUnit(Ruleset *rules, const int *cells){
+    int unit = rules->numUnits++;
+    for(int i = 0; i < rules->size; i++){
+        rules->units[unit][i] = cells[i];
+        rules->cellUnits[cells[i]][rules->numCellUnits[cells[i]]++] = unit;
+    }
+}
+
+// Fill in the units and peers for a variant
+void buildRuleset(Ruleset *rules, int boxSize, int variant){
+    int cells[MAX_GRID_SIZE] = {0};
+    int size = boxSize * boxSize;
+
+    memset(rules, 0, sizeof(Ruleset));
+    rules->classic = variant == Classic;
+    rules->boxSize = boxSize;
+    rules->size = size;
+    rules->numCells = size * size;
+
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            cells[j] = i * size + j;
+        }
+        addUnit(rules, cells);
+    }
+
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            cells[j] = j * size + i;
+        }
+        addUnit(rules, cells);
+    }
+
+    for(int i = 0; i < size; i++){
+        int count = 0;
+        for(int j = 0; j < rules->numCells; j++){
+            int row = j / size;
+            int col = j % size;
+            if(variant == Jigsaw ? JIGSAW_LAYOUT[j] - ASCII_LETTER_DIFF == i :
+                    (row / boxSize) * boxSize + col / boxSize == i)
+                cells[count++] = j;
+        }
+        addUnit(rules, cells);
+    }
+
+    if(variant == Diagonal){
+        for(int i = 0; i < size; i++){
+            cells[i] = i * size + i;
+        }
+        addUnit(rules, cells);
+
+        for(int i = 0; i < size; i++){
+            cells[i] = i * size + (size - 1 - i);
+        }
+        addUnit(rules, cells);
+    }
+
+    // The four windows inside the box borders, starting at 2B, 2F, 6B and 6F
+    if(variant == Hyper){
+        for(int i = 0; i < 4; i++){
+            int rowStart = 1 + (i / 2) * (boxSize + 1);
+            int colStart = 1 + (i % 2) * (boxSize + 1);
+            for(int j = 0; j < size; j++){
+                cells[j] = (rowStart + j / boxSize) * size + colStart + j % boxSize;
+            }
+            addUnit(rules, cells);
+        }
+    }
+
+    for(int i = 0; i < rules->numCells; i++){
+        bool seen[MAX_GRID_CELLS] = {false};
+        seen[i] = true;
+        for(int j = 0; j < rules->numCellUnits[i]; j++){
+            const unsigned char *unit = rules->units[rules->cellUnits[i][j]];
+            for(int k = 0; k < size; k++){
+                if(!seen[unit[k]]){
+                    seen[unit[k]] = true;
+                    rules->peers[i][rules->numPeers[i]++] = unit[k];
+                }
+            }
+        }
+    }
+}
+
+void initRulesets(){
+    for(int i = 0; i < VARIANT_MENU_SIZE; i++){
+        buildRuleset(&RULESETS[i], BOX_SIZE, Classic + i);
+    }
+    buildRuleset(&LARGE_CLASSIC_RULES, MAX_BOX_SIZE, Classic);
+
+    for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+        memcpy(CLASSIC_PEERS[i], RULESETS[0].peers[i], CLASSIC_PEERS_PER_CELL);
+    }
+}
+
+// Look up the rules for a grid size and variant. Only classic comes in 16x16
+const Ruleset *getRuleset(int boxSize, int variant){
+    pthread_once(&rulesetsOnce, initRulesets);
+    if(boxSize == MAX_BOX_SIZE)
+        return &LARGE_CLASSIC_RULES;
+    return &RULESETS[variant - Classic];
+}
+
+// Check a move against every unit of a ruleset
+bool moveIsValidForRules(int row, int col, int value, int **board, const Ruleset *rules){
+    int cell = row * BOARD_SIZE + col;
+    for(int i = 0; i < rules->numPeers[cell]; i++){
+        int peer = rules->peers[cell][i];
+        if(board[peer / BOARD_SIZE][peer % BOARD_SIZE] == value)
+            return false;
+    }
+
+    return true;
+}
+
+// Check a move in a classic game against the fixed table of 20 peers, which
+// is at least as fast as the row, column and box loops of
+// moveIsValidByPosition and skips looking up the ruleset
+bool moveIsValidClassic(int row, int col, int value, int **board){
+    const unsigned char *peers = CLASSIC_PEERS[row * BOARD_SIZE + col];
+    for(int i = 0; i < CLASSIC_PEERS_PER_CELL; i++){
+        if(board[peers[i] / BOARD_SIZE][peers[i] % BOARD_SIZE] == value)
+            return false;
+    }
+
+    return true;
+}
+
+// Check whether a move violates the constraints of a winning sudoku board.
+// Variant games use the rules set once when the game starts
 bool moveIsValid(int row, int col, int value, int **board){
+    if(currentRules == null || currentRules->classic)
+        return moveIsValidClassic(row, col, value, board);
+    return moveIsValidForRules(row, col, value, board, currentRules);
+}
+
+// The original classic check working from the square's position. Kept so
+// bench variants can compare the peer tables against it
+bool moveIsValidByPosition(int row, int col, int value, int **board){
     // Check if in row
     for(int i = 0; i < BOARD_SIZE; i++){
         if(i == col){
@@ -170,95 +776,346 @@ void display(int **board){
     }
     separator[boardWidth] = null;
 
-    printf("\n");
+    fprintf(gameOutput(), "\n");
 
     // Print column identifier letters
-    printf("   "); // for the left border char and row names
+    fprintf(gameOutput(), "   "); // for the left border char and row names
     for(int i = 0; i < BOARD_SIZE; i++){
         if(i % BOX_SIZE == 0 && i != 0)
-            printf("%s%s", spacer, spacer);
+            fprintf(gameOutput(), "%s%s", spacer, spacer);
 
-        printf("%s%c%s", spacer, COL_NAMES[i], spacer);
+        fprintf(gameOutput(), "%s%c%s", spacer, COL_NAMES[i], spacer);
     }
-    printf("\n");
+    fprintf(gameOutput(), "\n");
 
     // Print the top border
-    printf("  %c%s%c\n", LEFT_RIGHT_BORDER, separator, LEFT_RIGHT_BORDER);
+    fprintf(gameOutput(), "  %c%s%c\n", LEFT_RIGHT_BORDER, separator, LEFT_RIGHT_BORDER);
 
     // Print each row
     for(int i = 0; i < BOARD_SIZE; i++){
         // If divisible by 3, print the box separator
         if(i % BOX_SIZE == 0 && i != 0){
-            printf("  %c%s%c\n", LEFT_RIGHT_BORDER, separator, LEFT_RIGHT_BORDER);
+            fprintf(gameOutput(), "  %c%s%c\n", LEFT_RIGHT_BORDER, separator, LEFT_RIGHT_BORDER);
         }
 
         // Print the left border character
-        printf("%c %c", ROW_NAMES[i], LEFT_RIGHT_BORDER);
+        fprintf(gameOutput(), "%c %c", ROW_NAMES[i], LEFT_RIGHT_BORDER);
 
         // Print each column
         for(int j = 0; j < BOARD_SIZE; j++){
             // If divisible by 3, print the box separator
             if(j % BOX_SIZE == 0 && j != 0){
-                printf("%s", BOX_BORDER);
+                fprintf(gameOutput(), "%s", BOX_BORDER);
             }
 
             // If the space is blank, then we need to change the print format string
             // so that it doesn't print out 32
             if(board[i][j] == ' '){
-                printf("%s%s%s", spacer, (char*) &(board[i][j]), spacer);
+                fprintf(gameOutput(), "%s%s%s", spacer, (char*) &(board[i][j]), spacer);
             }else{
-                printf("%s%d%s", spacer, board[i][j], spacer);
+                fprintf(gameOutput(), "%s%d%s", spacer, board[i][j], spacer);
             }
         }
 
         //Print right border
-        printf("%c\n", LEFT_RIGHT_BORDER);
+        fprintf(gameOutput(), "%c\n", LEFT_RIGHT_BORDER);
     }
 
     // Print the bottom border
-    printf("  %c%s%c\n", LEFT_RIGHT_BORDER, separator, LEFT_RIGHT_BORDER);
+    fprintf(gameOutput(), "  %c%s%c\n", LEFT_RIGHT_BORDER, separator, LEFT_RIGHT_BORDER);
 
     // Free those space/separator strings
     free(spacer);
     free(separator);
 }
 
+// Fill peers with the cells that share a row, column, or box (or any other
+// unit of a variant) with a cell. Returns the number of peers
+int getPeers(int row, int col, int *peers){
+    int count = 0;
+
+    if(currentRules != null && !currentRules->classic){
+        int cell = row * BOARD_SIZE + col;
+        for(int i = 0; i < currentRules->numPeers[cell]; i++){
+            peers[i] = currentRules->peers[cell][i];
+        }
+        return currentRules->numPeers[cell];
+    }
+
+    int rowStart = row / BOX_SIZE * BOX_SIZE;
+    int colStart = col / BOX_SIZE * BOX_SIZE;
+
+    for(int i = 0; i < BOARD_SIZE; i++){
+        if(i != col)
+            peers[count++] = row * BOARD_SIZE + i;
+        if(i != row)
+            peers[count++] = i * BOARD_SIZE + col;
+    }
+
+    // Box cells not already covered by the row and column
+    for(int i = rowStart; i < rowStart + BOX_SIZE; i++){
+        for(int j = colStart; j < colStart + BOX_SIZE; j++){
+            if(i != row && j != col)
+                peers[count++] = i * BOARD_SIZE + j;
+        }
+    }
+
+    return count;
+}
+
+// Update the notes for a square changing from oldValue to newValue. Only
+// the square's peers are touched, so the cost is bounded for every move
+void updateNotes(Notes *notes, int row, int col, int oldValue, int newValue){
+    int peers[MAX_PEERS];
+
+    if(oldValue == newValue)
+        return;
+
+    int numPeers = getPeers(row, col, peers);
+
+    if(oldValue >= 1 && oldValue <= BOARD_SIZE){
+        for(int i = 0; i < numPeers; i++){
+            if(--notes->blockers[peers[i]][oldValue] == 0)
+                notes->candidates[peers[i]] |= 1 << oldValue;
+        }
+    }
+
+    if(newValue >= 1 && newValue <= BOARD_SIZE){
+        for(int i = 0; i < numPeers; i++){
+            if(notes->blockers[peers[i]][newValue]++ == 0)
+                notes->candidates[peers[i]] &= ~(1 << newValue);
+        }
+    }
+}
+
+// Build the notes for a whole board. Used when notes are turned on
+void initNotes(Notes *notes, int **board){
+    memset(notes->blockers, 0, sizeof(notes->blockers));
+    for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+        notes->candidates[i] = ((1 << BOARD_SIZE) - 1) << 1;
+    }
+
+    for(int i = 0; i < BOARD_SIZE; i++){
+        for(int j = 0; j < BOARD_SIZE; j++){
+            updateNotes(notes, i, j, SPACE_VAL, board[i][j]);
+        }
+    }
+}
+
+// Print a border line across the notes view
+void displayNotesBorder(char borderChar){
+    int boardWidth = NOTE_CELL_WIDTH * BOARD_SIZE + (int)strlen(BOX_BORDER) * (BOARD_SIZE / BOX_SIZE - 1);
+    fprintf(gameOutput(), "  %c", LEFT_RIGHT_BORDER);
+    for(int i = 0; i < boardWidth; i++){
+        fputc(borderChar, gameOutput());
+    }
+    fprintf(gameOutput(), "%c\n", LEFT_RIGHT_BORDER);
+}
+
+// Display the board with each empty square drawn as a 3x3 grid of the
+// values it can still take
+void displayNotes(int **board, Notes *notes){
+    FILE *out = gameOutput();
+
+    fprintf(out, "\n   ");
+    for(int i = 0; i < BOARD_SIZE; i++){
+        if(i % BOX_SIZE == 0 && i != 0)
+            fprintf(out, "%s", BOX_BORDER);
+
+        fprintf(out, "  %c  ", COL_NAMES[i]);
+    }
+    fprintf(out, "\n");
+
+    for(int i = 0; i < BOARD_SIZE; i++){
+        if(i % BOX_SIZE == 0)
+            displayNotesBorder(ROW_SEP_CHAR);
+        else
+            displayNotesBorder('-');
+
+        for(int line = 0; line < BOX_SIZE; line++){
+            // The row name goes on the middle line of the row
+            fprintf(out, "%c %c", line == BOX_SIZE / 2 ? ROW_NAMES[i] : ' ', LEFT_RIGHT_BORDER);
+
+            for(int j = 0; j < BOARD_SIZE; j++){
+                if(j % BOX_SIZE == 0 && j != 0)
+                    fprintf(out, "%s", BOX_BORDER);
+
+                if(board[i][j] != SPACE_VAL){
+                    if(line == BOX_SIZE / 2)
+                        fprintf(out, " [%d] ", board[i][j]);
+                    else
+                        fprintf(out, "     ");
+                    continue;
+                }
+
+                fputc(' ', out);
+                for(int k = 0; k < BOX_SIZE; k++){
+                    int value = line * BOX_SIZE + k + 1;
+                    if(notes->candidates[i * BOARD_SIZE + j] & (1 << value))
+                        fputc(value + ASCII_NUM_DIFF, out);
+                    else
+                        fputc('.', out);
+                }
+                fputc(' ', out);
+            }
+
+            fprintf(out, "%c\n", LEFT_RIGHT_BORDER);
+        }
+    }
+
+    displayNotesBorder(ROW_SEP_CHAR);
+}
+
+// Display the board the way the player has asked to see it
+void showBoard(int **board, GameStats *stats){
+    if(stats->notesOn)
+        displayNotes(board, stats->notes);
+    else
+        display(board);
+}
+
 // Prompt the user for a move/input action
 char *getMove(){
-    char *userInput = malloc(16);
-    printf("\nEnter a command. Type 'help' for how to play:\n\n");
-    printf("%c ", INPUT_CHAR);
-    fgets(userInput, 16, stdin);
+    char *userInput = malloc(MOVE_INPUT_SIZE);
+    printf("%s%c ", COMMAND_PROMPT, INPUT_CHAR);
+    fgets(userInput, MOVE_INPUT_SIZE, stdin);
     return userInput;
 }
 
-// Check whether a move is valid
-bool isMove(const char *move){
-    bool validRow = false;
-    bool validCol = false;
-    bool validVal = false;
+// Skip spaces and tabs
+static inline const char *skipBlanks(const char *text){
+    while(*text == ' ' || *text == '\t'){
+        text++;
+    }
+    return text;
+}
 
-    if(strlen(move) - 1 != 4){
-        return false;
+// Match a keyword without regard to case. On success text is moved past it
+static bool matchWord(const char **text, const char *word){
+    const char *p = *text;
+    while(*word != '\0'){
+        if((*p | 0x20) != *word)
+            return false;
+        p++;
+        word++;
     }
 
-    if(move[2] != ' '){
+    // The keyword has to end here, so "hints" is not "hint"
+    if(*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
         return false;
-    }
 
-    for(int i = 0; i < BOARD_SIZE; i++){
-        if(ROW_NAMES[i] == move[0])
-            validRow = true;
+    *text = p;
+    return true;
+}
 
-        if(COL_NAMES[i] == move[1])
-            validCol = true;
+// True if only whitespace is left on the line
+static bool atLineEnd(const char *text){
+    text = skipBlanks(text);
+    return *text == '\0' || *text == '\n' || (*text == '\r' && (text[1] == '\0' || text[1] == '\n'));
+}
 
-        if(i + 1 + ASCII_NUM_DIFF == move[3])
-            validVal = true;
-    }
+// Parse one or more moves such as "1A 1; 2b3 ;5E 9"
+static bool parseMoves(const char *text, Command *command){
+    command->numMoves = 0;
+    while(true){
+        if(command->numMoves == MAX_BATCH_MOVES)
+            return false;
+
+        ParsedMove *move = &command->moves[command->numMoves];
+        text = skipBlanks(text);
+        if(*text < '1' || *text > '0' + BOARD_SIZE)
+            return false;
+        move->row = *text++ - ASCII_NUM_DIFF - 1;
+
+        text = skipBlanks(text);
+        char col = *text++ & ~0x20;
+        if(col < ASCII_LETTER_DIFF || col >= ASCII_LETTER_DIFF + BOARD_SIZE)
+            return false;
+        move->col = col - ASCII_LETTER_DIFF;
+
+        // A value of 0 or . clears the square
+        text = skipBlanks(text);
+        if(*text == '.'){
+            move->value = 0;
+            text++;
+        }else if(*text >= '0' && *text <= '0' + BOARD_SIZE){
+            move->value = *text++ - ASCII_NUM_DIFF;
+        }else{
+            return false;
+        }
+        command->numMoves++;
 
-    return validRow && validCol && validVal;
+        text = skipBlanks(text);
+        if(*text != ';')
+            return atLineEnd(text);
+        text++;
+    }
+}
 
+// Parse a line of input into a command in a single pass. Dispatches on the
+// first character so the cost doesn't grow with the number of commands.
+// The save name points into the line rather than being copied
+void parseCommand(const char *line, Command *command){
+    const char *p = skipBlanks(line);
+    command->type = Error;
+
+    switch(*p | 0x20){
+        case 'q':
+            if(matchWord(&p, "quit") && atLineEnd(p))
+                command->type = Quit;
+            break;
+        case 'h':
+            if(matchWord(&p, "help") && atLineEnd(p))
+                command->type = Help;
+            else if(matchWord(&p, "hint") && atLineEnd(p))
+                command->type = Hint;
+            break;
+        case 'c':
+            if(!matchWord(&p, "checking"))
+                break;
+            p = skipBlanks(p);
+            if(matchWord(&p, "on") && atLineEnd(p)){
+                command->type = Check_Toggle;
+                command->toggleOn = true;
+            }else if(matchWord(&p, "off") && atLineEnd(p)){
+                command->type = Check_Toggle;
+                command->toggleOn = false;
+            }
+            break;
+        case 'n':
+            if(!matchWord(&p, "notes"))
+                break;
+            p = skipBlanks(p);
+            if(matchWord(&p, "on") && atLineEnd(p)){
+                command->type = Notes_Toggle;
+                command->toggleOn = true;
+            }else if(matchWord(&p, "off") && atLineEnd(p)){
+                command->type = Notes_Toggle;
+                command->toggleOn = false;
+            }
+            break;
+        case 's':
+        {
+            if(!matchWord(&p, "save"))
+                break;
+            p = skipBlanks(p);
+            int length = strcspn(p, "\r\n");
+            while(length > 0 && (p[length - 1] == ' ' || p[length - 1] == '\t')){
+                length--;
+            }
+            if(length > 0){
+                command->type = Save;
+                command->name = p;
+                command->nameLength = length;
+            }
+            break;
+        }
+        default:
+            // Digits have no lower case form, so the | 0x20 leaves them alone
+            if(parseMoves(p, command))
+                command->type = Move;
+            break;
+    }
 }
 
 // Check if the board is full.  This is used to see if the board
@@ -282,12 +1139,10 @@ void printHint(int **board, int **solutionBoard){
     int colCount = 0;
     bool hintFound = false;
     bool isFull = hasFinished(board);
-    time_t t;
 
     // Generate a random position on the board to start searching for hints
-    srand((unsigned) time(&t));
-    int curRow = rand() % BOARD_SIZE;
-    int origCol = rand() % BOARD_SIZE;
+    int curRow = rand_r(&gameSeed) % BOARD_SIZE;
+    int origCol = rand_r(&gameSeed) % BOARD_SIZE;
 
     // Needs to be BOARD_SIZE + 1 because we will end in the same column we started in,
     // processing the columns skipped the first time around
@@ -310,7 +1165,7 @@ void printHint(int **board, int **solutionBoard){
                     board[rowPosition][colPosition]) ||
                     (!isFull && board[rowPosition][colPosition] == SPACE_VAL)){
                 colLetter = (char) colPosition + ASCII_LETTER_DIFF;
-                printf("\nChange the value at %d%c to %d\n", rowPosition + 1, colLetter, solutionBoard[rowPosition][colPosition]);
+                fprintf(gameOutput(), "\nChange the value at %d%c to %d\n", rowPosition + 1, colLetter, solutionBoard[rowPosition][colPosition]);
                 hintFound = true;
                 break;
             }
@@ -322,59 +1177,60 @@ void printHint(int **board, int **solutionBoard){
     }
 
     if(!hintFound){
-        printf("\nNo hints available");
+        fprintf(gameOutput(), "\nNo hints available");
     }
 }
 
-// Parse a move entered by the user and take the appropriate action
-int doMove(int ***board, const char *move, int **solutionBoard, GameStats **stats){
-    if(strcmp(move, "quit\n") == 0){
-        return Quit;
-    }
-
-    if(strcmp(move, "help\n") == 0){
-        printf("\n%s\n", HELP_MSG);
-        return Help;
-    }
-
-    if(strcmp(move, "hint\n") == 0){
-        printHint(*board, solutionBoard);
-        return Hint;
-    }
-
-    if(strcmp(move, "checking on\n") == 0){
-        (*stats)->checksOn = true;
-        printf("\n%s\n", "checking is turned on");
-        return Check_Toggle;
-    }
-
-    if(strcmp(move, "checking off\n") == 0){
-        (*stats)->checksOn = false;
-        printf("\n%s\n", "checking is turned off");
-        return Check_Toggle;
-    }
-
-    if(strncmp(move, "save ", SAVE_N_CMP) == 0){
-        return Save;
-    }
-
-    // In this sense isMove means "will it change the value on the board?"
-    if(isMove(move)){
-        int rowPosition = move[0] - ASCII_NUM_DIFF - 1;
-        int colPosition = move[1] - ASCII_LETTER_DIFF;
-        int value = move[3] - ASCII_NUM_DIFF;
+// Parse a move entered by the user and take the appropriate action.
+// numApplied is set to the number of moves from a batch put on the board
+int doMove(int ***board, const char *move, int **solutionBoard, GameStats **stats, int *numApplied){
+    Command command;
+    parseCommand(move, &command);
+    *numApplied = 0;
 
-        if((*stats)->checksOn && !moveIsValid(rowPosition, colPosition, value, *board)){
-            printf("\nChecks are on. This move violates constraints on a winning board.\n");
-            return Check;
-        }else{
-            (*board)[rowPosition][colPosition] = value;
-        }
+    switch(command.type){
+        case Help:
+            fprintf(gameOutput(), "\n%s\n", HELP_MSG);
+            break;
+        case Hint:
+            printHint(*board, solutionBoard);
+            break;
+        case Check_Toggle:
+            (*stats)->checksOn = command.toggleOn;
+            fprintf(gameOutput(), "\n%s\n", command.toggleOn ? "checking is turned on" : "checking is turned off");
+            break;
+        case Move:
+            // Moves in a batch are made in order. One that fails the check
+            // stops the batch but the moves before it are kept
+            for(int i = 0; i < command.numMoves; i++){
+                ParsedMove *next = &command.moves[i];
+                int value = next->value == 0 ? SPACE_VAL : next->value;
+                if((*stats)->checksOn && next->value != 0 &&
+                        !moveIsValid(next->row, next->col, value, *board)){
+                    fprintf(gameOutput(), "\nChecks are on. This move violates constraints on a winning board.\n");
+                    return Check;
+                }
 
-        return Move;
+                if((*stats)->notesOn)
+                    updateNotes((*stats)->notes, next->row, next->col, (*board)[next->row][next->col], value);
+                (*board)[next->row][next->col] = value;
+                (*numApplied)++;
+            }
+            break;
+        case Notes_Toggle:
+            (*stats)->notesOn = command.toggleOn;
+            if(command.toggleOn){
+                if((*stats)->notes == null)
+                    (*stats)->notes = malloc(sizeof(Notes));
+                initNotes((*stats)->notes, *board);
+            }
+            fprintf(gameOutput(), "\n%s\n", command.toggleOn ? "notes are turned on" : "notes are turned off");
+            break;
+        default:
+            break;
     }
 
-    return Error;
+    return command.type;
 }
 
 // Called after each move that alters the board to check
@@ -391,10 +1247,14 @@ bool hasWon(int **board){
     return true;
 }
 
+// Seconds spent on a game so far, including time before it was last loaded
+int gameSeconds(GameStats *stats){
+    return (int)(time(null) - stats->startTime) + stats->elapsedTime;
+}
+
 // Upon winning the game, use the game stats to calculate the score
 int calculateScore(GameStats *stats){
-    time_t endTime = time(null);
-    int totalTime = (int)(endTime - stats->startTime) + stats->elapsedTime;
+    int totalTime = gameSeconds(stats);
     int score = BASE_SCORE;
     score -= totalTime / TIME_COST_FACTOR;
     score -= (BASE_SCORE - score) * DIFFICULTY_COST_FACTOR * (Hard - stats->difficulty);
@@ -403,132 +1263,607 @@ int calculateScore(GameStats *stats){
     return score;
 }
 
-// Save the game by writing out the board, solution board, and stats, all of which are
-// rudimentary encrypted using a simple cipher, to a file of the name of the user's choosing
+// Saves are 106 bytes, with all numbers little endian:
+//
+//   "CDKG", version, variant, difficulty, checking on
+//   elapsed seconds, hints, checks (4 bytes each)
+//   the board and then the solution board, a square to each 4 bits with
+//   0 for an empty square
+//   CRC-32 of everything before it (4 bytes)
+//
+// Saves from before this format are text, with the boards and stats
+// offset by CIPHER_OFFSET. readSaveFile still reads them
+
+void putLittleEndian(unsigned char *bytes, unsigned long long value, int width){
+    for(int i = 0; i < width; i++){
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+unsigned long long getLittleEndian(const unsigned char *bytes, int width){
+    unsigned long long value = 0;
+    for(int i = 0; i < width; i++){
+        value |= (unsigned long long)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+// CRC-32 (the zlib polynomial) of a block of bytes, worked out a bit at a
+// time. Saves are small enough that a lookup table isn't worth it
+unsigned int crc32(const unsigned char *bytes, size_t length){
+    unsigned int crc = 0xffffffffu;
+    for(size_t i = 0; i < length; i++){
+        crc ^= bytes[i];
+        for(int bit = 0; bit < 8; bit++){
+            crc = (crc >> 1) ^ (CRC32_POLYNOMIAL & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+void packBoardNibbles(int **board, unsigned char *bytes){
+    memset(bytes, 0, SAVE_BOARD_BYTES);
+    for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+        int value = board[i / BOARD_SIZE][i % BOARD_SIZE];
+        bytes[i / 2] |= (value == SPACE_VAL ? 0 : value) << (4 * (i % 2));
+    }
+}
+
+// Encode a game in the binary save format
+void packSave(int **board, int **solutionBoard, GameStats *stats, int elapsedTime, unsigned char *bytes){
+    memcpy(bytes, SAVE_MAGIC, 4);
+    bytes[4] = SAVE_VERSION;
+    bytes[5] = stats->variant;
+    bytes[6] = stats->difficulty;
+    bytes[7] = stats->checksOn;
+    putLittleEndian(bytes + 8, elapsedTime, 4);
+    putLittleEndian(bytes + 12, stats->numHints, 4);
+    putLittleEndian(bytes + 16, stats->numChecks, 4);
+    packBoardNibbles(board, bytes + 20);
+    packBoardNibbles(solutionBoard, bytes + 20 + SAVE_BOARD_BYTES);
+    putLittleEndian(bytes + SAVE_BINARY_SIZE - 4, crc32(bytes, SAVE_BINARY_SIZE - 4), 4);
+}
+
+// Save the game by writing out the board, solution board, and stats to a
+// file of the name of the user's choosing
 bool saveGame(int **board, int **solutionBoard, GameStats *stats, char *filename){
+    unsigned char bytes[SAVE_BINARY_SIZE];
+    packSave(board, solutionBoard, stats, gameSeconds(stats), bytes);
+
     // Try to open file
     FILE *fp;
-    fp = fopen(filename, "w");
+    fp = fopen(filename, "wb");
 
     // File open failed
     if(fp == null){
         return true;
     }
 
-    // Write board all on one line
-    for(int i = 0; i < BOARD_SIZE; i++){
-        for(int j = 0; j < BOARD_SIZE; j++){
-            fprintf(fp, "%c", (char)(board[i][j] + CIPHER_OFFSET));
-        }
-    }
+    bool failed = fwrite(bytes, 1, SAVE_BINARY_SIZE, fp) != SAVE_BINARY_SIZE;
+    failed |= fclose(fp) != 0;
+    if(failed)
+        return true;
+
+    fprintf(gameOutput(), "\nGame saved\n");
 
-    fprintf(fp, "\n");
+    return 0;
+}
 
-    // Write solution board all on one line
+// FNV-1a hash of a solution board and its variant. Games are matched up by
+// solution since a loaded save no longer knows which squares were clues
+unsigned long long hashSolution(int **solutionBoard, int variant){
+    unsigned long long hash = FNV_OFFSET_BASIS;
+    hash = (hash ^ (unsigned char)variant) * FNV_PRIME;
     for(int i = 0; i < BOARD_SIZE; i++){
         for(int j = 0; j < BOARD_SIZE; j++){
-            fprintf(fp, "%c", (char)(solutionBoard[i][j] + CIPHER_OFFSET));
+            hash = (hash ^ (unsigned char)solutionBoard[i][j]) * FNV_PRIME;
         }
     }
 
-    fprintf(fp, "\n");
-
-    // Write each game stat on a separate line
-    fprintf(fp, "%d\n", stats->checksOn + CIPHER_OFFSET);
-    fprintf(fp, "%d\n", stats->elapsedTime + (int)(time(null) - stats->startTime) + CIPHER_OFFSET);
-    fprintf(fp, "%d\n", stats->numHints + CIPHER_OFFSET);
-    fprintf(fp, "%d\n", stats->numChecks + CIPHER_OFFSET);
-    fprintf(fp, "%d\n", stats->difficulty + CIPHER_OFFSET);
-    fprintf(fp, "\n");
-
-    fclose(fp);
+    // 0 marks an empty slot in the index
+    return hash == 0 ? 1 : hash;
+}
 
-    printf("\nGame saved\n");
+// Put a record into the top scores for its difficulty if it makes the cut.
+// Ties go to the earlier game
+void insertTopScore(ScoreIndexHeader *header, const ScoreRecord *record, long long recordNumber){
+    int difficulty = record->difficulty - Easy;
+    ScoreEntry *top = header->top[difficulty];
+    int count = header->numTop[difficulty];
+
+    int position = count;
+    while(position > 0 && top[position - 1].score < record->score)
+        position--;
+    if(position == TOP_SCORES)
+        return;
 
-    return 0;
+    if(count < TOP_SCORES)
+        count++;
+    memmove(&top[position + 1], &top[position], sizeof(ScoreEntry) * (count - 1 - position));
+    top[position].score = record->score;
+    top[position].record = recordNumber;
+    header->numTop[difficulty] = count;
 }
 
-// If the user chose to save the game, then parse the move text to grab
-// the name of the file they entered
-char *getSaveFilename(const char *move){
-    char *filename = malloc(strlen(move) - SAVE_N_CMP);
-    strncpy(filename, &move[SAVE_N_CMP], strlen(&move[SAVE_N_CMP]) - 1);
-    return filename;
+// Find the slot for a puzzle in the table of bests by linear probing. The
+// slot is empty if the puzzle hasn't been seen
+PuzzleBest *findPuzzleBest(ScoreIndexHeader *header, unsigned long long hash){
+    PuzzleBest *table = (PuzzleBest *)(header + 1);
+    long long mask = header->tableCapacity - 1;
+    long long slot = hash & mask;
+    while(table[slot].hash != 0 && table[slot].hash != hash)
+        slot = (slot + 1) & mask;
+    return &table[slot];
 }
 
-// Loop that processes each turn/action made while playing the 
-// sudoku game
-void play(int **board, int **solutionBoard, GameStats *stats){
-    display(board);
-    while(true){
-        bool isQuit = false;
-        bool isSaved = false;
-        bool isHelp = false;
-        bool isMove = false;
-        bool isError = false;
+// Resize the index file for a table of capacity slots and map it
+ScoreIndexHeader *mapScoreIndex(int fd, long long capacity){
+    size_t size = sizeof(ScoreIndexHeader) + sizeof(PuzzleBest) * capacity;
+    if(ftruncate(fd, size) != 0)
+        return null;
 
-        const char *move = getMove();
-        enum moveTypeEnum moveType = doMove(&board, move, solutionBoard, &stats);
+    void *map = mmap(null, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return map == MAP_FAILED ? null : map;
+}
 
-        switch(moveType){
-            case Move:
-                isMove = true;
-                break;
-            case Help:
-                isHelp = true;
-                break;
-            case Quit:
-                isQuit = true;
-                break;
-            case Hint:
-                stats->numHints++;
-                break;
-            case Check:
-                stats->numChecks++;
-                break;
-            case Save:
-                isSaved = true;
-                break;
-            case Error:
-                isError = true;
-                break;
-            default:
-                break;
+// Double the table of bests, keeping it at most half full so probes stay short
+ScoreIndexHeader *growScoreIndex(int fd, ScoreIndexHeader *header){
+    long long oldCapacity = header->tableCapacity;
+    size_t oldSize = sizeof(ScoreIndexHeader) + sizeof(PuzzleBest) * oldCapacity;
+    PuzzleBest *old = malloc(sizeof(PuzzleBest) * oldCapacity);
+    memcpy(old, header + 1, sizeof(PuzzleBest) * oldCapacity);
+    munmap(header, oldSize);
+
+    header = mapScoreIndex(fd, oldCapacity * 2);
+    if(header != null){
+        header->tableCapacity = oldCapacity * 2;
+        memset(header + 1, 0, sizeof(PuzzleBest) * header->tableCapacity);
+        for(long long i = 0; i < oldCapacity; i++){
+            if(old[i].hash != 0)
+                *findPuzzleBest(header, old[i].hash) = old[i];
         }
+    }
 
-        if(isError){
-            printf("\nInvalid input\n");
-        }
+    free(old);
+    return header;
+}
 
-        if(isSaved){
-            char *saveFile = getSaveFilename(move);
-            bool saveFailed = saveGame(board, solutionBoard, stats, saveFile);
-            free(saveFile);
+// Returns true if a mapped index can't be trusted: its header doesn't match
+// the file's size or a log of numRecords records, or it points outside them
+bool scoreIndexDamaged(const ScoreIndexHeader *header, off_t size, long long numRecords){
+    long long capacity = header->tableCapacity;
+    if(memcmp(header->magic, SCORE_INDEX_MAGIC, 4) != 0 || header->numRecords < 0 || header->numRecords > numRecords ||
+            capacity < SCORE_TABLE_MIN_CAPACITY || (capacity & (capacity - 1)) != 0 ||
+            capacity > (long long)(size / sizeof(PuzzleBest)) ||
+            size != (off_t)(sizeof(ScoreIndexHeader) + sizeof(PuzzleBest) * capacity) ||
+            header->numPuzzles < 0 || header->numPuzzles * 2 > capacity)
+        return true;
 
-            if(saveFailed){
-                printf("\nFailed to save game\n");
-            }else{
-                free((void *) move);
-                break;
-            }
+    for(int i = 0; i < 3; i++){
+        if(header->numTop[i] < 0 || header->numTop[i] > TOP_SCORES)
+            return true;
+        for(int j = 0; j < header->numTop[i]; j++){
+            if(header->top[i][j].record < 0 || header->top[i][j].record >= header->numRecords)
+                return true;
         }
+    }
+    return false;
+}
 
-        free((void *) move);
-        
-        if(isQuit){
-            break;
+// Map the score index, bringing it up to date with any records in the log
+// it hasn't seen. An index that is missing, damaged or doesn't match the
+// log is rebuilt from the start. The caller holds a lock on the index file
+ScoreIndexHeader *openScoreIndex(int fd){
+    struct stat indexStat;
+    struct stat logStat;
+    long long numRecords = 0;
+    int logFd = open(SCORE_LOG_FILE, O_RDONLY);
+
+    if(logFd >= 0 && fstat(logFd, &logStat) == 0)
+        numRecords = logStat.st_size / sizeof(ScoreRecord);
+    if(fstat(fd, &indexStat) != 0){
+        if(logFd >= 0)
+            close(logFd);
+        return null;
+    }
+
+    ScoreIndexHeader *header = null;
+    if(indexStat.st_size >= (off_t)sizeof(ScoreIndexHeader)){
+        header = mmap(null, indexStat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(header == MAP_FAILED){
+            header = null;
+        }else if(scoreIndexDamaged(header, indexStat.st_size, numRecords)){
+            munmap(header, indexStat.st_size);
+            header = null;
+        }
+    }
+
+    if(header == null){
+        header = mapScoreIndex(fd, SCORE_TABLE_MIN_CAPACITY);
+        if(header == null){
+            if(logFd >= 0)
+                close(logFd);
+            return null;
+        }
+        memset(header, 0, sizeof(ScoreIndexHeader) + sizeof(PuzzleBest) * SCORE_TABLE_MIN_CAPACITY);
+        memcpy(header->magic, SCORE_INDEX_MAGIC, 4);
+        header->tableCapacity = SCORE_TABLE_MIN_CAPACITY;
+    }
+
+    if(header->numRecords < numRecords){
+        size_t logSize = numRecords * sizeof(ScoreRecord);
+        const ScoreRecord *records = mmap(null, logSize, PROT_READ, MAP_SHARED, logFd, 0);
+        if(records == MAP_FAILED){
+            munmap(header, sizeof(ScoreIndexHeader) + sizeof(PuzzleBest) * header->tableCapacity);
+            close(logFd);
+            return null;
+        }
+
+        for(long long i = header->numRecords; i < numRecords && header != null; i++){
+            const ScoreRecord *record = &records[i];
+            if(record->difficulty < Easy || record->difficulty > Hard ||
+                    record->variant < Classic || record->variant > Jigsaw){
+                header->numRecords = i + 1;
+                continue;
+            }
+
+            insertTopScore(header, record, i);
+
+            PuzzleBest *best = findPuzzleBest(header, record->puzzleHash);
+            if(best->hash == 0){
+                best->hash = record->puzzleHash;
+                best->score = record->score;
+                best->record = i;
+                header->numPuzzles++;
+                if(header->numPuzzles * 2 > header->tableCapacity)
+                    header = growScoreIndex(fd, header);
+            }else if(record->score > best->score){
+                best->score = record->score;
+                best->record = i;
+            }
+
+            if(header != null)
+                header->numRecords = i + 1;
+        }
+        munmap((void *)records, logSize);
+    }
+
+    if(logFd >= 0)
+        close(logFd);
+    return header;
+}
+
+// Map the score index read only if it is intact and has seen every one of
+// the numRecords records in the log. The caller holds a shared lock on it
+ScoreIndexHeader *mapCurrentScoreIndex(int fd, long long numRecords){
+    struct stat indexStat;
+    if(fstat(fd, &indexStat) != 0 || indexStat.st_size < (off_t)sizeof(ScoreIndexHeader))
+        return null;
+
+    ScoreIndexHeader *header = mmap(null, indexStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(header == MAP_FAILED)
+        return null;
+    if(scoreIndexDamaged(header, indexStat.st_size, numRecords) || header->numRecords != numRecords){
+        munmap(header, indexStat.st_size);
+        return null;
+    }
+    return header;
+}
+
+void closeScoreIndex(ScoreIndexHeader *header){
+    if(header != null)
+        munmap(header, sizeof(ScoreIndexHeader) + sizeof(PuzzleBest) * header->tableCapacity);
+}
+
+void fillScoreRecord(ScoreRecord *record, int **solutionBoard, GameStats *stats, int score){
+    memset(record, 0, sizeof(ScoreRecord));
+    record->timestamp = time(null);
+    record->puzzleHash = hashSolution(solutionBoard, stats->variant);
+    record->score = score;
+    record->seconds = gameSeconds(stats);
+    record->numHints = stats->numHints;
+    record->numChecks = stats->numChecks;
+    record->difficulty = stats->difficulty;
+    record->variant = stats->variant;
+}
+
+// Append a record to the score log and update the index. Fills in the best
+// score for the puzzle so far. Returns true if either file fails
+bool writeScoreRecord(const ScoreRecord *record, int *best){
+    // Appends of a whole record at once don't interleave with other games
+    int logFd = open(SCORE_LOG_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if(logFd < 0)
+        return true;
+    bool failed = write(logFd, record, sizeof(ScoreRecord)) != sizeof(ScoreRecord);
+    close(logFd);
+    if(failed)
+        return true;
+
+    int indexFd = open(SCORE_INDEX_FILE, O_RDWR | O_CREAT, 0644);
+    if(indexFd < 0)
+        return true;
+    flock(indexFd, LOCK_EX);
+
+    ScoreIndexHeader *header = openScoreIndex(indexFd);
+    if(header != null)
+        *best = findPuzzleBest(header, record->puzzleHash)->score;
+    closeScoreIndex(header);
+
+    flock(indexFd, LOCK_UN);
+    close(indexFd);
+    return header == null;
+}
+
+// Record a finished game in the score log and fill in the best score for
+// the puzzle so far. Returns true if the score couldn't be recorded
+bool recordScore(int **solutionBoard, GameStats *stats, int score, int *best){
+    ScoreRecord record;
+    fillScoreRecord(&record, solutionBoard, stats, score);
+    return writeScoreRecord(&record, best);
+}
+
+// Hand a finished game to the score writer's thread
+void queueScore(ScoreWriter *writer, int **solutionBoard, GameStats *stats, int score){
+    pthread_mutex_lock(&writer->lock);
+    if(writer->numPending == writer->capacity){
+        writer->capacity = writer->capacity == 0 ? 16 : writer->capacity * 2;
+        writer->pending = realloc(writer->pending, sizeof(ScoreRecord) * writer->capacity);
+    }
+    fillScoreRecord(&writer->pending[writer->numPending++], solutionBoard, stats, score);
+    pthread_cond_signal(&writer->ready);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+// Write queued records until the writer is stopped and the queue is empty
+void *scoreWriterMain(void *arg){
+    ScoreWriter *writer = arg;
+    ScoreRecord *batch = null;
+    int batchCapacity = 0;
+
+    pthread_mutex_lock(&writer->lock);
+    while(true){
+        while(writer->numPending == 0 && !writer->stopping)
+            pthread_cond_wait(&writer->ready, &writer->lock);
+        if(writer->numPending == 0)
+            break;
+
+        // Take the whole queue so the server isn't held up while writing
+        int numRecords = writer->numPending;
+        if(numRecords > batchCapacity){
+            batchCapacity = writer->capacity;
+            batch = realloc(batch, sizeof(ScoreRecord) * batchCapacity);
+        }
+        memcpy(batch, writer->pending, sizeof(ScoreRecord) * numRecords);
+        writer->numPending = 0;
+        pthread_mutex_unlock(&writer->lock);
+
+        for(int i = 0; i < numRecords; i++){
+            int best;
+            if(writeScoreRecord(&batch[i], &best))
+                fprintf(stderr, "failed to record a score\n");
+        }
+        pthread_mutex_lock(&writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    free(batch);
+    return null;
+}
+
+void startScoreWriter(ScoreWriter *writer){
+    memset(writer, 0, sizeof(ScoreWriter));
+    pthread_mutex_init(&writer->lock, null);
+    pthread_cond_init(&writer->ready, null);
+    pthread_create(&writer->thread, null, scoreWriterMain, writer);
+}
+
+// Write out anything still queued and stop the writer's thread
+void stopScoreWriter(ScoreWriter *writer){
+    pthread_mutex_lock(&writer->lock);
+    writer->stopping = true;
+    pthread_cond_signal(&writer->ready);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, null);
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->ready);
+    free(writer->pending);
+}
+
+// Print the best scores for each difficulty. Only the index and the records
+// it points at are read, never the whole log. The index is read under a
+// shared lock, and only locked exclusively to bring it up to date when it
+// is missing, stale or damaged
+void showHighScores(){
+    struct stat logStat;
+    long long numRecords = 0;
+    ScoreIndexHeader *header = null;
+
+    int logFd = open(SCORE_LOG_FILE, O_RDONLY);
+    if(logFd >= 0 && fstat(logFd, &logStat) == 0)
+        numRecords = logStat.st_size / sizeof(ScoreRecord);
+
+    int indexFd = open(SCORE_INDEX_FILE, O_RDONLY);
+    if(indexFd >= 0){
+        flock(indexFd, LOCK_SH);
+        header = mapCurrentScoreIndex(indexFd, numRecords);
+        if(header == null){
+            flock(indexFd, LOCK_UN);
+            close(indexFd);
+            indexFd = -1;
+        }
+    }
+    if(header == null && numRecords > 0){
+        indexFd = open(SCORE_INDEX_FILE, O_RDWR | O_CREAT, 0644);
+        if(indexFd >= 0){
+            flock(indexFd, LOCK_EX);
+            header = openScoreIndex(indexFd);
+        }
+    }
+
+    size_t logSize = header != null ? header->numRecords * sizeof(ScoreRecord) : 0;
+    const ScoreRecord *records = MAP_FAILED;
+    if(logFd >= 0 && logSize > 0)
+        records = mmap(null, logSize, PROT_READ, MAP_SHARED, logFd, 0);
+
+    if(records == MAP_FAILED){
+        printf("\nNo scores yet\n");
+    }else{
+        printf("\n%lld games played on %lld different puzzles\n", header->numRecords, header->numPuzzles);
+        for(int i = 0; i < DIFFICULTY_MENU_SIZE; i++){
+            printf("\n%s:\n", DIFFICULTY_MENU_OPTIONS[i]);
+            if(header->numTop[i] == 0)
+                printf("\tNo games finished\n");
+
+            for(int j = 0; j < header->numTop[i]; j++){
+                const ScoreRecord *record = &records[header->top[i][j].record];
+                const char *variant = record->variant >= Classic && record->variant <= Jigsaw ?
+                    VARIANT_NAMES[record->variant - Classic] : "unknown";
+                time_t when = record->timestamp;
+                char date[32];
+                strftime(date, sizeof(date), "%Y-%m-%d", localtime(&when));
+                printf("\t%2d) %4d/%d  %s  %-8s %3d:%02d  %d hints  %d checks\n", j + 1, record->score, BASE_SCORE,
+                    date, variant, record->seconds / 60, record->seconds % 60,
+                    record->numHints, record->numChecks);
+            }
+        }
+        munmap((void *)records, logSize);
+    }
+
+    if(logFd >= 0)
+        close(logFd);
+    closeScoreIndex(header);
+    if(indexFd >= 0){
+        flock(indexFd, LOCK_UN);
+        close(indexFd);
+    }
+}
+
+// If the user chose to save the game, then parse the move text to grab
+// the name of the file they entered
+char *getSaveFilename(const char *move){
+    Command command;
+    parseCommand(move, &command);
+    char *filename = malloc(command.nameLength + 1);
+    memcpy(filename, command.name, command.nameLength);
+    filename[command.nameLength] = '\0';
+    return filename;
+}
+
+// Process a single turn/action. Returns true when the game is over, either
+// because it was won, saved, or quit
+bool playTurn(int **board, int **solutionBoard, GameStats *stats, const char *move){
+    bool isQuit = false;
+    bool isSaved = false;
+    bool isHelp = false;
+    bool isMove = false;
+    bool isError = false;
+    int numApplied;
+
+    enum moveTypeEnum moveType = doMove(&board, move, solutionBoard, &stats, &numApplied);
+
+    switch(moveType){
+        case Move:
+            isMove = true;
+            break;
+        case Help:
+            isHelp = true;
+            break;
+        case Quit:
+            isQuit = true;
+            break;
+        case Hint:
+            stats->numHints++;
+            break;
+        case Check:
+            // The moves of a batch before the refused one still count
+            stats->numChecks++;
+            isMove = numApplied > 0;
+            break;
+        case Save:
+            isSaved = true;
+            break;
+        case Error:
+            isError = true;
+            break;
+        default:
+            break;
+    }
+
+    if(isError){
+        fprintf(gameOutput(), "\nInvalid input\n");
+    }
+
+    if(isSaved){
+        char *saveFile = getSaveFilename(move);
+        bool saveFailed = saveGame(board, solutionBoard, stats, saveFile);
+        free(saveFile);
+
+        if(saveFailed){
+            fprintf(gameOutput(), "\nFailed to save game\n");
+        }else{
+            return true;
+        }
+    }
+
+    if(isQuit){
+        return true;
+    }
+
+    if(!isHelp)
+        showBoard(board, stats);
+
+    if(isMove && hasWon(board)){
+        int score = calculateScore(stats);
+        int best;
+        fprintf(gameOutput(), "\n%s", WIN_MESSAGE);
+        fprintf(gameOutput(), "\nScore is %d/%d", score, BASE_SCORE);
+        if(scoreWriter != null)
+            queueScore(scoreWriter, solutionBoard, stats, score);
+        else if(recordScores && !recordScore(solutionBoard, stats, score, &best))
+            fprintf(gameOutput(), "\nBest score on this puzzle is %d/%d", best, BASE_SCORE);
+        fprintf(gameOutput(), "\n%s\n", SCORE_MESSAGE);
+        return true;
+    } else if(isMove && hasFinished(board)){
+        fprintf(gameOutput(), "\n%s\n", FULL_BUT_INCORRECT);
+    }
+
+    return false;
+}
+
+// Explain the extra rules of a variant before its game starts
+void printRules(int variant){
+    if(variant == Diagonal){
+        printf("\nDiagonal: both long diagonals must also hold 1 to 9\n");
+    }else if(variant == Hyper){
+        printf("\nHyper: the four windows of 3x3 squares starting at 2B, 2F, 6B, and 6F\n"
+            "must also hold 1 to 9\n");
+    }else if(variant == Jigsaw){
+        printf("\nJigsaw: the boxes are replaced by these regions, which must each hold 1 to 9\n\n   ");
+        for(int i = 0; i < BOARD_SIZE; i++){
+            printf("%c", COL_NAMES[i]);
         }
+        for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+            if(i % BOARD_SIZE == 0)
+                printf("\n%c  ", ROW_NAMES[i / BOARD_SIZE]);
+            printf("%c", JIGSAW_LAYOUT[i] | 0x20);
+        }
+        printf("\n");
+    }
+}
 
-        if(!isHelp)
-            display(board);
+// Loop that processes each turn/action made while playing the 
+// sudoku game
+void play(int **board, int **solutionBoard, GameStats *stats){
+    printRules(stats->variant);
+    display(board);
+    while(true){
+        const char *move = getMove();
+        bool isOver = playTurn(board, solutionBoard, stats, move);
+        free((void *) move);
 
-        if(isMove && hasWon(board)){
-            printf("\n%s", WIN_MESSAGE);
-            printf("\nScore is %d/%d", calculateScore(stats), BASE_SCORE);
-            printf("\n%s\n", SCORE_MESSAGE);
+        if(isOver){
             break;
-        } else if(isMove && hasFinished(board)){
-            printf("\n%s\n", FULL_BUT_INCORRECT);
         }
     }
 }
@@ -591,6 +1926,17 @@ void freeBoard(int **board){
     free(board);
 }
 
+// Allocate a new board holding the same values as an existing one
+int **copyBoard(int **board){
+    int **copy = malloc(sizeof(int *) * BOARD_SIZE);
+    for(int i = 0; i < BOARD_SIZE; i++){
+        copy[i] = malloc(sizeof(int) * BOARD_SIZE);
+        memcpy(copy[i], board[i], sizeof(int) * BOARD_SIZE);
+    }
+
+    return copy;
+}
+
 // Returns the next column that will be filled in with a value when generating a board
 int getNextCol(int **board, int row, BuildValue **colChoices, int *numChoices){
     int leastChoices = BOARD_SIZE + 1;
@@ -632,10 +1978,8 @@ int getNextCol(int **board, int row, BuildValue **colChoices, int *numChoices){
 
 // After generating a board, remove a certain number of values
 // depending on the difficulty chosen
-void removeValues(int difficulty, int ***board){
+void removeValues(int difficulty, int ***board, unsigned int *seed){
     int numToRemove;
-    time_t t;
-    srand((unsigned) time(&t));
     int row;
     int col;
     int numRemoved = 0;
@@ -649,8 +1993,8 @@ void removeValues(int difficulty, int ***board){
         numToRemove = HARD_REMOVE;
 
     while(numRemoved < numToRemove){
-        row = rand() % BOARD_SIZE;
-        col = rand() % BOARD_SIZE;
+        row = rand_r(seed) % BOARD_SIZE;
+        col = rand_r(seed) % BOARD_SIZE;
         if((*board)[row][col] != EMPTY_CHAR){
             (*board)[row][col] = EMPTY_CHAR;
             numRemoved++;
@@ -668,32 +2012,30 @@ void initBoard(int ***board){
     }
 }
 
-int **generateBoard(int difficulty, int ***solutionBoard){
-    time_t start = time(null);
-    time_t t;
+// Generate a board and its solution. Rows are filled in one at a time and a
+// row that runs out of choices is cleared and tried again. After too many
+// retries the whole board is started over. Returns null if cancel gets set
+// before the board is finished
+int **generateBoardCancellable(int difficulty, int ***solutionBoard, unsigned int *seed, atomic_int *cancel){
     int **board = malloc(sizeof(int *) * BOARD_SIZE);
     *solutionBoard = malloc(sizeof(int *) * BOARD_SIZE);
     initBoard(&board);
     initBoard(solutionBoard);
-
-    srand((unsigned) time(&t));
+    int rowRetries = 0;
 
     for(int i = 0; i < BOARD_SIZE; i++){
-        BuildValue *rowChoices = initBuildValue();
-        int maxRange = BOARD_SIZE;
         for(int j = 0; j < BOARD_SIZE; j++){
             int nextCol;
             int numChoices;
             int rNum;
             BuildValue *colChoices;
 
-            // Looks like we're stuck. Let's try again
-            time_t now = time(null);
-            if((now - start) > TIMEOUT){
-                initBoard(&board);
-                i = -1;
-                start = time(null);
-                break;
+            // A relaxed load is all the cancel check costs per square
+            if(cancel != null && atomic_load_explicit(cancel, memory_order_relaxed)){
+                freeBoard(board);
+                freeBoard(*solutionBoard);
+                *solutionBoard = null;
+                return null;
             }
 
             nextCol = getNextCol(board, i, &colChoices, &numChoices);
@@ -705,8 +2047,19 @@ int **generateBoard(int difficulty, int ***solutionBoard){
                     (*solutionBoard)[i][k] = -1;
                 }
                 j = -1;
+
+                // Looks like we're stuck. Let's try again
+                if(++rowRetries > ROW_RETRY_LIMIT){
+                    for(int k = 0; k < BOARD_SIZE * BOARD_SIZE; k++){
+                        board[k / BOARD_SIZE][k % BOARD_SIZE] = -1;
+                        (*solutionBoard)[k / BOARD_SIZE][k % BOARD_SIZE] = -1;
+                    }
+                    rowRetries = 0;
+                    i = -1;
+                    break;
+                }
             }else{
-                rNum = (rand() % numChoices);
+                rNum = (rand_r(seed) % numChoices);
                 board[i][nextCol] = getBuildValue(colChoices, rNum);
                 (*solutionBoard)[i][nextCol] = board[i][nextCol];
             }
@@ -715,15 +2068,21 @@ int **generateBoard(int difficulty, int ***solutionBoard){
         }
     }
 
-    removeValues(difficulty, &board);
+    removeValues(difficulty, &board, seed);
 
     return board;
 }
 
+int **generateBoard(int difficulty, int ***solutionBoard){
+    unsigned int seed = rand();
+    return generateBoardCancellable(difficulty, solutionBoard, &seed, null);
+}
+
 void initStats(GameStats *stats, int difficulty){
-    memset(stats, sizeof(GameStats), '\0');
+    memset(stats, '\0', sizeof(GameStats));
     stats->startTime = time(null);
     stats->difficulty = difficulty;
+    stats->variant = Classic;
 }
 
 bool loadBoard(FILE *fp, int ***board){
@@ -731,7 +2090,7 @@ bool loadBoard(FILE *fp, int ***board){
     initBoard(board);
     char boardLine[BOARD_SIZE * BOARD_SIZE + 2];
     void *result = (void *)fgets(boardLine, sizeof(boardLine), fp);
-    if(result == null){
+    if(result == null || strlen(boardLine) < BOARD_SIZE * BOARD_SIZE){
         return true;
     }
 
@@ -752,19 +2111,15 @@ bool loadBoard(FILE *fp, int ***board){
 }
 
 bool readStatsInt(FILE *fp, int *stat){
-    char *nextLine = malloc(64);
+    char nextLine[64];
     void *result = (void *)fgets(nextLine, sizeof(nextLine), fp);
     if(result == null){
-        free(nextLine);
         return true;
     }
 
-    // Remove the newline character
-    nextLine[strlen(nextLine) - 1] = '\0';
-
-    // Read the integer
+    // Read the integer. A blank line counts as an error
     int readInt = sscanf(nextLine, "%d", stat);
-    if(!readInt){
+    if(readInt != 1){
         return true;
     }
 
@@ -773,47 +2128,200 @@ bool readStatsInt(FILE *fp, int *stat){
 }
 
 bool loadStats(FILE *fp, GameStats *stats){    
-    return (readStatsInt(fp, &stats->checksOn) || readStatsInt(fp, &stats->elapsedTime) ||
-        readStatsInt(fp, &stats->numHints) || readStatsInt(fp, &stats->numChecks) ||
-        readStatsInt(fp, &stats->difficulty));
+    if(readStatsInt(fp, &stats->checksOn) || readStatsInt(fp, &stats->elapsedTime) ||
+            readStatsInt(fp, &stats->numHints) || readStatsInt(fp, &stats->numChecks) ||
+            readStatsInt(fp, &stats->difficulty))
+        return true;
+
+    // Saves from before variants end with a blank line here
+    if(readStatsInt(fp, &stats->variant) || stats->variant < Classic || stats->variant > Jigsaw)
+        stats->variant = Classic;
+
+    return false;
 }
 
-bool loadGame(int ***board, int ***solutionBoard, GameStats *stats){
-    // Prompt for and read in game name
-    char *gameName = malloc(256);
-    printf(" ");
-    // Do an fgets to clear the input buffer
-    fgets(gameName, 256, stdin);
-    printf("\nType the name of the name you'd like to load:\n\n");
-    printf("%c ", INPUT_CHAR);
-    fgets(gameName, 256, stdin);
-    gameName[strlen(gameName) - 1] = '\0';
+// Read the board lines and stats of a text save
+bool readTextSave(FILE *fp, SaveFile *save){
+    if(loadBoard(fp, &save->board) || loadBoard(fp, &save->solutionBoard)){
+        save->error = "boards aren't in the text save format";
+        return true;
+    }
 
-    // Try to open the file
-    FILE *fp;
-    fp = fopen(gameName, "r");
-    free(gameName);
+    if(loadStats(fp, &save->stats)){
+        save->error = "stats are missing";
+        return true;
+    }
 
-    // File open failed
-    if(fp == null){
+    save->size = ftell(fp);
+    return false;
+}
+
+bool unpackBoardNibbles(const unsigned char *bytes, int ***board){
+    *board = malloc(sizeof(int *) * BOARD_SIZE);
+    initBoard(board);
+    for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+        int value = (bytes[i / 2] >> (4 * (i % 2))) & 0xf;
+        if(value > BOARD_SIZE)
+            return true;
+        (*board)[i / BOARD_SIZE][i % BOARD_SIZE] = value == 0 ? SPACE_VAL : value;
+    }
+    return false;
+}
+
+// Decode a binary save after checking its size, version and checksum
+bool unpackSave(const unsigned char *bytes, size_t length, SaveFile *save){
+    if(length != SAVE_BINARY_SIZE){
+        save->error = "binary save is the wrong size";
+        return true;
+    }
+    if(bytes[4] != SAVE_VERSION){
+        save->error = "binary save is from an unknown version";
+        return true;
+    }
+    if(getLittleEndian(bytes + SAVE_BINARY_SIZE - 4, 4) != crc32(bytes, SAVE_BINARY_SIZE - 4)){
+        save->error = "checksum mismatch";
         return true;
     }
 
-    // Read in boards and return if an error is encountered
-    if(loadBoard(fp, board) || loadBoard(fp, solutionBoard))
+    save->stats.variant = bytes[5];
+    save->stats.difficulty = bytes[6];
+    save->stats.checksOn = bytes[7];
+    save->stats.elapsedTime = (int)getLittleEndian(bytes + 8, 4);
+    save->stats.numHints = (int)getLittleEndian(bytes + 12, 4);
+    save->stats.numChecks = (int)getLittleEndian(bytes + 16, 4);
+    if(save->stats.variant < Classic || save->stats.variant > Jigsaw){
+        save->error = "unknown variant";
         return true;
+    }
 
-    // Read in the stats
-    if(loadStats(fp, stats))
+    if(unpackBoardNibbles(bytes + 20, &save->board) ||
+            unpackBoardNibbles(bytes + 20 + SAVE_BOARD_BYTES, &save->solutionBoard)){
+        save->error = "board holds a value out of range";
         return true;
+    }
+    return false;
+}
 
-    // Set the new start time
-    stats->startTime = time(null);
+// Returns true if a save's stats hold values no game could have reached
+bool checkSaveStats(const GameStats *stats){
+    return stats->checksOn < 0 || stats->checksOn > 1 || stats->difficulty < Easy || stats->difficulty > Hard ||
+        stats->elapsedTime < 0 || stats->numHints < 0 || stats->numChecks < 0;
+}
+
+// Read a save in either format without asking the player anything.
+// Returns true, with save->error set, if it can't be read
+bool readSaveFile(const char *filename, SaveFile *save){
+    unsigned char bytes[SAVE_BINARY_SIZE + 1];
+    bool failed;
+
+    memset(save, 0, sizeof(SaveFile));
+    FILE *fp = fopen(filename, "rb");
+    if(fp == null){
+        save->error = strerror(errno);
+        return true;
+    }
 
+    size_t length = fread(bytes, 1, sizeof(bytes), fp);
+    if(length >= 4 && memcmp(bytes, SAVE_MAGIC, 4) == 0){
+        save->binary = true;
+        save->size = length;
+        failed = unpackSave(bytes, length, save);
+    }else{
+        rewind(fp);
+        failed = readTextSave(fp, save);
+    }
     fclose(fp);
+
+    if(!failed && checkSaveStats(&save->stats)){
+        save->error = "stats out of range";
+        failed = true;
+    }
+
+    if(failed){
+        freeBoard(save->board);
+        freeBoard(save->solutionBoard);
+        save->board = null;
+        save->solutionBoard = null;
+        return true;
+    }
+
+    // Set the new start time
+    save->stats.startTime = time(null);
+    return false;
+}
+
+bool loadGame(int ***board, int ***solutionBoard, GameStats *stats){
+    SaveFile save;
+    char gameName[256];
+    memset(stats, '\0', sizeof(GameStats));
+
+    // Prompt for and read in game name
+    printf(" ");
+    // Do an fgets to clear the input buffer
+    fgets(gameName, sizeof(gameName), stdin);
+    printf("\nType the name of the name you'd like to load:\n\n");
+    printf("%c ", INPUT_CHAR);
+    if(fgets(gameName, sizeof(gameName), stdin) == null)
+        return true;
+    gameName[strcspn(gameName, "\n")] = '\0';
+
+    if(readSaveFile(gameName, &save))
+        return true;
+
+    *board = save.board;
+    *solutionBoard = save.solutionBoard;
+    *stats = save.stats;
     return false;
 }
 
+void *speculationMain(void *arg){
+    Speculation *spec = arg;
+    spec->board = generateBoardCancellable(spec->difficulty, &spec->solutionBoard, &spec->seed, &spec->cancel);
+    atomic_store_explicit(&spec->done, true, memory_order_release);
+    return null;
+}
+
+// Start generating a board for a difficulty unless one is already on the way
+void startSpeculation(Speculation *spec, int difficulty){
+    if(spec->running)
+        return;
+
+    spec->difficulty = difficulty;
+    spec->seed = rand();
+    spec->board = null;
+    spec->solutionBoard = null;
+    atomic_init(&spec->done, false);
+    atomic_init(&spec->cancel, false);
+    spec->running = pthread_create(&spec->thread, null, speculationMain, spec) == 0;
+}
+
+// Take the board generated in the background, waiting for it if it isn't
+// ready yet. Falls back to generating here if the thread couldn't start
+int **adoptSpeculation(Speculation *spec, int difficulty, int ***solutionBoard){
+    if(!spec->running)
+        return generateBoard(difficulty, solutionBoard);
+
+    if(!atomic_load_explicit(&spec->done, memory_order_acquire))
+        printf("\nPlease wait while board generates...\n");
+
+    pthread_join(spec->thread, null);
+    spec->running = false;
+    *solutionBoard = spec->solutionBoard;
+    return spec->board;
+}
+
+// Stop a background generation and throw away its board
+void cancelSpeculation(Speculation *spec){
+    if(!spec->running)
+        return;
+
+    atomic_store_explicit(&spec->cancel, true, memory_order_relaxed);
+    pthread_join(spec->thread, null);
+    spec->running = false;
+    freeBoard(spec->board);
+    freeBoard(spec->solutionBoard);
+}
+
 // A generic routine for displaying a list of options and returning the user's choice
 int getListOption(char *menu_title, const char **list_options, int numOptions){
     bool validOption = false;
@@ -851,51 +2359,2610 @@ void printStats(GameStats *stats){
     printf("Start time: %d\n", (int)stats->startTime);
 }
 
-int main(){
-    while(true){
-        printf("Welcome to Dylan's Sudoku!\n\n");
-        enum mainEnum listOption = 
-            getListOption(MAIN_MENU_TITLE, MAIN_MENU_OPTIONS, MAIN_MENU_SIZE);
+// Seconds on a monotonic clock, used for benchmarks and throughput reports
+double nowSeconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-        int **board = null;
-        int **solutionBoard = null;
-        GameStats stats;
+// The units a cell belongs to. Classic cells always sit in exactly a row,
+// a column and a box, so the count is a constant the compiler can unroll
+static inline int solverCellUnits(const Solver *s, int cell, int *units, const bool classic){
+    int numUnits = classic ? 3 : s->rules->numCellUnits[cell];
+    for(int i = 0; i < numUnits; i++){
+        units[i] = s->rules->cellUnits[cell][i];
+    }
+    return numUnits;
+}
 
-        switch(listOption){
-            case NewGame:
-            {
-                printf("\n");
-                enum difficultyEnum difficulty = 
-                    getListOption(DIFFICULTY_MENU_TITLE, DIFFICULTY_MENU_OPTIONS, DIFFICULTY_MENU_SIZE);
-                printf("\nPlease wait while board generates...\n");
-                board = generateBoard(difficulty, &solutionBoard);
+// Place a value into an empty cell and mark it in the cell's units
+static inline void solverPlaceFor(Solver *s, int cell, int value, const bool classic){
+    int units[MAX_CELL_UNITS];
+    int numUnits = solverCellUnits(s, cell, units, classic);
+    s->cells[cell] = value;
+    for(int i = 0; i < numUnits; i++){
+        s->unitMask[units[i]] |= 1u << value;
+    }
+}
 
-                initStats(&stats, difficulty);
-                char junk[256];
-                // Clear stdin buffer
-                fgets(junk, 256, stdin);
-                play(board, solutionBoard, &stats);
-                freeBoard(board);
-                freeBoard(solutionBoard);
-                break;
-            }
-            case LoadGame:
-            {
-                bool loadOkay = !loadGame(&board, &solutionBoard, &stats);
-                if(loadOkay){
-                    play(board, solutionBoard, &stats);
-                }else{
-                    printf("\n\nInvalid or nonexistent file.\n\n");
-                }
+// Undo solverPlace
+static inline void solverClearFor(Solver *s, int cell, const bool classic){
+    int units[MAX_CELL_UNITS];
+    int numUnits = solverCellUnits(s, cell, units, classic);
+    for(int i = 0; i < numUnits; i++){
+        s->unitMask[units[i]] &= ~(1u << s->cells[cell]);
+    }
+    s->cells[cell] = 0;
+}
 
-                freeBoard(board);
-                freeBoard(solutionBoard);
+// Values that can still be placed in an empty cell
+static inline unsigned int solverCandidatesFor(const Solver *s, int cell, const bool classic){
+    int units[MAX_CELL_UNITS];
+    int numUnits = solverCellUnits(s, cell, units, classic);
+    unsigned int used = 0;
+    for(int i = 0; i < numUnits; i++){
+        used |= s->unitMask[units[i]];
+    }
+    return (((1u << s->size) - 1) << 1) & ~used;
+}
+
+// Choose the empty cell with the fewest candidates. Returns -1 when the grid
+// is full. A returned cell with no candidates means the branch is dead
+static inline int solverPickCellFor(const Solver *s, unsigned int *candidates, const bool classic){
+    int bestCell = -1;
+    int bestCount = MAX_GRID_SIZE + 1;
+
+    for(int i = 0; i < s->numCells; i++){
+        if(s->cells[i] != 0)
+            continue;
+
+        unsigned int choices = solverCandidatesFor(s, i, classic);
+        int count = __builtin_popcount(choices);
+        if(count < bestCount){
+            bestCount = count;
+            bestCell = i;
+            *candidates = choices;
+            if(count <= 1)
                 break;
-            }
-            case Exit:
+        }
+    }
+
+    return bestCell;
+}
+
+static inline void solverPlace(Solver *s, int cell, int value){
+    solverPlaceFor(s, cell, value, s->rules->classic);
+}
+
+static inline void solverClear(Solver *s, int cell){
+    solverClearFor(s, cell, s->rules->classic);
+}
+
+static inline unsigned int solverCandidates(const Solver *s, int cell){
+    return solverCandidatesFor(s, cell, s->rules->classic);
+}
+
+int solverPickCell(const Solver *s, unsigned int *candidates){
+    return solverPickCellFor(s, candidates, s->rules->classic);
+}
+
+// Set up a solver from a list of cell values where 0 is empty. Returns true
+// if the givens already conflict with each other
+bool initSolver(Solver *s, const Ruleset *rules, const unsigned char *cells){
+    memset(s, 0, sizeof(Solver));
+    s->rules = rules;
+    s->boxSize = rules->boxSize;
+    s->size = rules->size;
+    s->numCells = rules->numCells;
+
+    for(int i = 0; i < s->numCells; i++){
+        if(cells[i] == 0)
+            continue;
+
+        if(cells[i] > s->size || !(solverCandidates(s, i) & (1u << cells[i])))
+            return true;
+
+        solverPlace(s, i, cells[i]);
+    }
+
+    return false;
+}
+
+// Count solutions by backtracking, stopping once limit is reached (0 means
+// no limit). The cancel flag lets another thread abandon the search early.
+// The search is compiled once with classic set, so the unit lookups fold
+// away for classic grids, and once for the table driven variants
+#define DEFINE_COUNT_SOLUTIONS(name, classic)                                   \
+long name(Solver *s, long limit, atomic_int *cancel){                           \
+    unsigned int candidates;                                                    \
+    int cell = solverPickCellFor(s, &candidates, classic);                      \
+    long count = 0;                                                             \
+                                                                                \
+    if(cell == -1)                                                              \
+        return 1;                                                               \
+                                                                                \
+    if(cancel != null && atomic_load_explicit(cancel, memory_order_relaxed))    \
+        return 0;                                                               \
+                                                                                \
+    while(candidates){                                                          \
+        int value = __builtin_ctz(candidates);                                  \
+        candidates &= candidates - 1;                                           \
+                                                                                \
+        solverPlaceFor(s, cell, value, classic);                                \
+        count += name(s, limit == 0 ? 0 : limit - count, cancel);               \
+        solverClearFor(s, cell, classic);                                       \
+                                                                                \
+        if(limit != 0 && count >= limit)                                        \
+            break;                                                              \
+    }                                                                           \
+                                                                                \
+    return count;                                                               \
+}
+
+DEFINE_COUNT_SOLUTIONS(countSolutionsClassic, true)
+DEFINE_COUNT_SOLUTIONS(countSolutionsByUnits, false)
+
+long countSolutions(Solver *s, long limit, atomic_int *cancel){
+    if(s->rules->classic)
+        return countSolutionsClassic(s, limit, cancel);
+    return countSolutionsByUnits(s, limit, cancel);
+}
+
+// Look up a variant by name. Returns 0 if there isn't one
+int parseVariant(const char *name){
+    for(int i = 0; i < VARIANT_MENU_SIZE; i++){
+        if(strcmp(name, VARIANT_NAMES[i]) == 0)
+            return Classic + i;
+    }
+    return 0;
+}
+
+// Parse a whole decimal argument of at least min. Returns true if it isn't one
+bool parseNumberArg(const char *text, long min, long *value){
+    char *end;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if(end == text || *end != '\0' || errno != 0 || parsed < min)
+        return true;
+    *value = parsed;
+    return false;
+}
+
+// Parse a puzzle written as one line of 81 (9x9) or 256 (16x16) characters.
+// Empty cells are '.' or '0', values above 9 use the letters A-G. Variants
+// other than classic are 9x9 only
+bool parsePuzzle(const char *line, int variant, Solver *s){
+    unsigned char cells[MAX_GRID_CELLS];
+    int length = 0;
+    int boxSize;
+
+    while(line[length] != '\0' && line[length] != '\n' && line[length] != '\r')
+        length++;
+
+    if(length == BOARD_SIZE * BOARD_SIZE)
+        boxSize = 3;
+    else if(length == MAX_GRID_CELLS && variant == Classic)
+        boxSize = MAX_BOX_SIZE;
+    else
+        return true;
+
+    for(int i = 0; i < length; i++){
+        char c = line[i];
+        if(c == '.' || c == '0')
+            cells[i] = 0;
+        else if(c >= '1' && c <= '9')
+            cells[i] = c - ASCII_NUM_DIFF;
+        else if(c >= 'A' && c <= 'G')
+            cells[i] = c - ASCII_LETTER_DIFF + 10;
+        else
+            return true;
+    }
+
+    return initSolver(s, getRuleset(boxSize, variant), cells);
+}
+
+// One randomized attempt at filling the grid, giving up once it has tried
+// budget placements
+bool fillRandomAttempt(Solver *s, unsigned int *seed, long *budget){
+    unsigned int candidates;
+    int cell = solverPickCell(s, &candidates);
+
+    if(cell == -1)
+        return false;
+
+    while(candidates && --(*budget) > 0){
+        // Pick one of the remaining candidates at random
+        int pick = rand_r(seed) % __builtin_popcount(candidates);
+        unsigned int choices = candidates;
+        for(int i = 0; i < pick; i++){
+            choices &= choices - 1;
+        }
+        int value = __builtin_ctz(choices);
+        candidates &= ~(1u << value);
+
+        solverPlace(s, cell, value);
+        if(!fillRandomAttempt(s, seed, budget))
+            return false;
+        solverClear(s, cell);
+    }
+
+    return true;
+}
+
+// Fill the empty cells of a grid with a random solution. Returns true if
+// the grid can't be completed. Random fills now and then wander into a
+// long dead end (jigsaw regions especially), so attempts that take too
+// long are abandoned and started over with new choices
+bool fillRandomSolution(Solver *s, unsigned int *seed){
+    while(true){
+        long budget = FILL_ATTEMPT_BUDGET;
+        if(!fillRandomAttempt(s, seed, &budget))
+            return false;
+        if(budget > 0)
+            return true;
+    }
+}
+
+// Fill orbit with the cells that must stay the same (all clues or all
+// blank) as cell under a symmetry. Returns the number of cells in the orbit
+int symmetryOrbit(const Solver *s, int cell, enum symmetryEnum symmetry, int *orbit){
+    int row = cell / s->size;
+    int col = cell % s->size;
+    int other;
+
+    orbit[0] = cell;
+    if(symmetry == Rotational)
+        other = s->numCells - 1 - cell;
+    else if(symmetry == Mirror)
+        other = row * s->size + (s->size - 1 - col);
+    else
+        return 1;
+
+    if(other == cell)
+        return 1;
+
+    orbit[1] = other;
+    return 2;
+}
+
+// True if the puzzle has a solution where cell holds something other than
+// value. Reuses the puzzle's masks rather than building a new solver
+bool hasOtherSolution(Solver *puzzle, int cell, int value){
+    unsigned int candidates = solverCandidates(puzzle, cell) & ~(1u << value);
+
+    while(candidates){
+        int other = __builtin_ctz(candidates);
+        candidates &= candidates - 1;
+
+        solverPlace(puzzle, cell, other);
+        long found = countSolutions(puzzle, 1, null);
+        solverClear(puzzle, cell);
+
+        if(found > 0)
+            return true;
+    }
+
+    return false;
+}
+
+// Remove clues from a full grid until none (or no symmetric pair) can be
+// removed without the puzzle losing its unique solution.
+//
+// Each clue is only tested once. Taking clues out can only add solutions,
+// so a clue that was needed stays needed for the rest of the pass. Testing
+// a clue only asks whether a solution exists with a different value in its
+// cells, since any second solution has to differ from the first there
+void makeMinimal(Solver *puzzle, enum symmetryEnum symmetry, unsigned int *seed){
+    unsigned char solution[MAX_GRID_CELLS];
+    int order[MAX_GRID_CELLS];
+    int orbit[2];
+
+    memcpy(solution, puzzle->cells, puzzle->numCells);
+
+    for(int i = 0; i < puzzle->numCells; i++){
+        order[i] = i;
+    }
+    for(int i = puzzle->numCells - 1; i > 0; i--){
+        int j = rand_r(seed) % (i + 1);
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+
+    for(int i = 0; i < puzzle->numCells; i++){
+        if(puzzle->cells[order[i]] == 0)
+            continue;
+
+        int orbitSize = symmetryOrbit(puzzle, order[i], symmetry, orbit);
+        for(int j = 0; j < orbitSize; j++){
+            solverClear(puzzle, orbit[j]);
+        }
+
+        bool unique = true;
+        for(int j = 0; j < orbitSize && unique; j++){
+            unique = !hasOtherSolution(puzzle, orbit[j], solution[orbit[j]]);
+        }
+
+        if(!unique){
+            for(int j = 0; j < orbitSize; j++){
+                solverPlace(puzzle, orbit[j], solution[orbit[j]]);
+            }
+        }
+    }
+}
+
+// Generate a minimal puzzle with a unique solution
+void generateMinimal(Solver *puzzle, const Ruleset *rules, enum symmetryEnum symmetry, unsigned int *seed){
+    unsigned char empty[MAX_GRID_CELLS] = {0};
+    initSolver(puzzle, rules, empty);
+    fillRandomSolution(puzzle, seed);
+    makeMinimal(puzzle, symmetry, seed);
+}
+
+// Write a puzzle in the one line format parsePuzzle reads
+void formatPuzzle(const Solver *s, char *line){
+    for(int i = 0; i < s->numCells; i++){
+        int value = s->cells[i];
+        if(value == 0)
+            line[i] = '.';
+        else if(value <= 9)
+            line[i] = value + ASCII_NUM_DIFF;
+        else
+            line[i] = value - 10 + ASCII_LETTER_DIFF;
+    }
+    line[s->numCells] = '\0';
+}
+
+void initDeque(TaskDeque *deque){
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    for(int i = 0; i < DEQUE_CAPACITY; i++){
+        atomic_init(&deque->tasks[i], null);
+    }
+}
+
+// Push a task on the owner's end. Returns true if the deque is full
+bool dequePush(TaskDeque *deque, Solver *task){
+    long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if(b - t >= DEQUE_CAPACITY)
+        return true;
+
+    atomic_store_explicit(&deque->tasks[b & (DEQUE_CAPACITY - 1)], task, memory_order_release);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    return false;
+}
+
+// Pop a task from the owner's end, racing thieves for the last one
+Solver *dequePop(TaskDeque *deque){
+    long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    Solver *task = null;
+
+    if(t <= b){
+        task = atomic_load_explicit(&deque->tasks[b & (DEQUE_CAPACITY - 1)], memory_order_relaxed);
+        if(t == b){
+            if(!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                    memory_order_seq_cst, memory_order_relaxed))
+                task = null;
+            atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        }
+    }else{
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return task;
+}
+
+// Take a task from the top of another thread's deque
+Solver *dequeSteal(TaskDeque *deque){
+    long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if(t >= b)
+        return null;
+
+    Solver *task = atomic_load_explicit(&deque->tasks[t & (DEQUE_CAPACITY - 1)], memory_order_acquire);
+    if(!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed))
+        return null;
+
+    return task;
+}
+
+// Add a finished task's solutions to the shared total and cancel the
+// search once the limit has been hit
+void flushSolutions(ParallelSearch *search, long count){
+    if(count == 0)
+        return;
+
+    long total = atomic_fetch_add_explicit(&search->found, count, memory_order_relaxed) + count;
+    if(search->limit != 0 && total >= search->limit)
+        atomic_store_explicit(&search->cancel, true, memory_order_relaxed);
+}
+
+// Shallow nodes are split into one task per candidate and pushed on the
+// worker's own deque. Deeper nodes are searched sequentially
+void runSearchTask(SearchWorker *worker, Solver *task){
+    ParallelSearch *search = worker->search;
+
+    if(task->depth >= SPLIT_DEPTH){
+        long remaining = 0;
+        if(search->limit != 0){
+            remaining = search->limit - atomic_load_explicit(&search->found, memory_order_relaxed);
+            if(remaining <= 0)
+                return;
+        }
+        flushSolutions(search, countSolutions(task, remaining, &search->cancel));
+        return;
+    }
+
+    unsigned int candidates;
+    int cell = solverPickCell(task, &candidates);
+    if(cell == -1){
+        flushSolutions(search, 1);
+        return;
+    }
+
+    while(candidates){
+        int value = __builtin_ctz(candidates);
+        candidates &= candidates - 1;
+
+        Solver *child = malloc(sizeof(Solver));
+        memcpy(child, task, sizeof(Solver));
+        solverPlace(child, cell, value);
+        child->depth++;
+
+        atomic_fetch_add_explicit(&search->pending, 1, memory_order_relaxed);
+        if(dequePush(&search->deques[worker->id], child)){
+            // Deque is full, so do the work here instead
+            runSearchTask(worker, child);
+            free(child);
+            atomic_fetch_sub_explicit(&search->pending, 1, memory_order_release);
+        }
+    }
+}
+
+void *searchWorkerMain(void *arg){
+    SearchWorker *worker = arg;
+    ParallelSearch *search = worker->search;
+
+    while(!atomic_load_explicit(&search->cancel, memory_order_relaxed)){
+        Solver *task = dequePop(&search->deques[worker->id]);
+
+        // Nothing local, so try to steal starting from a random victim
+        for(int i = 0; task == null && i < search->numThreads; i++){
+            int victim = (rand_r(&worker->seed) + i) % search->numThreads;
+            if(victim != worker->id)
+                task = dequeSteal(&search->deques[victim]);
+        }
+
+        if(task == null){
+            if(atomic_load_explicit(&search->pending, memory_order_acquire) == 0)
+                break;
+            sched_yield();
+            continue;
+        }
+
+        runSearchTask(worker, task);
+        free(task);
+        atomic_fetch_sub_explicit(&search->pending, 1, memory_order_release);
+    }
+
+    return null;
+}
+
+// Count the solutions of a puzzle on numThreads threads. Stops early once
+// limit solutions have been found (0 means count them all)
+long countSolutionsParallel(const Solver *puzzle, int numThreads, long limit){
+    ParallelSearch search;
+    pthread_t *threads = malloc(sizeof(pthread_t) * numThreads);
+    SearchWorker *workers = malloc(sizeof(SearchWorker) * numThreads);
+
+    search.numThreads = numThreads;
+    search.limit = limit;
+    search.deques = malloc(sizeof(TaskDeque) * numThreads);
+    atomic_init(&search.found, 0);
+    atomic_init(&search.pending, 1);
+    atomic_init(&search.cancel, false);
+
+    for(int i = 0; i < numThreads; i++){
+        initDeque(&search.deques[i]);
+    }
+
+    Solver *root = malloc(sizeof(Solver));
+    memcpy(root, puzzle, sizeof(Solver));
+    root->depth = 0;
+    dequePush(&search.deques[0], root);
+
+    for(int i = 0; i < numThreads; i++){
+        workers[i].search = &search;
+        workers[i].id = i;
+        workers[i].seed = (unsigned int)time(null) + i;
+        pthread_create(&threads[i], null, searchWorkerMain, &workers[i]);
+    }
+
+    for(int i = 0; i < numThreads; i++){
+        pthread_join(threads[i], null);
+    }
+
+    // Tasks left behind by a cancelled search
+    for(int i = 0; i < numThreads; i++){
+        Solver *task;
+        while((task = dequePop(&search.deques[i])) != null){
+            free(task);
+        }
+    }
+
+    long found = atomic_load(&search.found);
+    if(limit != 0 && found > limit)
+        found = limit;
+
+    free(search.deques);
+    free(workers);
+    free(threads);
+    return found;
+}
+
+// Number of threads to use when the user doesn't say
+int defaultThreadCount(){
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1 : (int)cpus;
+}
+
+// cdoku count [-t THREADS] [-l LIMIT] [-r VARIANT] [PUZZLE...]
+// Counts solutions for each puzzle given, or for each line of stdin
+int runCount(int argc, char **argv){
+    long numThreads = defaultThreadCount();
+    long limit = 0;
+    int variant = Classic;
+    int first = 0;
+
+    while(first < argc && argv[first][0] == '-'){
+        if(strcmp(argv[first], "-t") == 0 && first + 1 < argc){
+            if(parseNumberArg(argv[first + 1], 1, &numThreads) || numThreads > INT_MAX)
+                return 1;
+        }else if(strcmp(argv[first], "-l") == 0 && first + 1 < argc){
+            if(parseNumberArg(argv[first + 1], 0, &limit))
+                return 1;
+        }else if(strcmp(argv[first], "-r") == 0 && first + 1 < argc){
+            variant = parseVariant(argv[first + 1]);
+            if(variant == 0)
+                return 1;
+        }else{
+            return 1;
+        }
+        first += 2;
+    }
+
+    char line[PUZZLE_LINE_SIZE];
+    int argIndex = first;
+    while(true){
+        const char *puzzleText;
+        if(first < argc){
+            if(argIndex >= argc)
+                break;
+            puzzleText = argv[argIndex++];
+        }else{
+            if(fgets(line, sizeof(line), stdin) == null)
+                break;
+            puzzleText = line;
+        }
+
+        Solver puzzle;
+        if(parsePuzzle(puzzleText, variant, &puzzle)){
+            printf("invalid puzzle\n");
+            continue;
+        }
+
+        double start = nowSeconds();
+        long count = countSolutionsParallel(&puzzle, numThreads, limit);
+        double elapsed = nowSeconds() - start;
+        printf("%s%ld solutions (%.3f s)\n", (limit != 0 && count >= limit) ? "at least " : "",
+            count, elapsed);
+    }
+
+    return 0;
+}
+
+// A 17 clue puzzle with two clues taken out, which leaves enough
+// solutions to keep every core busy for a while
+const char *BENCH_COUNT_PUZZLE =
+    "000000010400000000020000000000050407008000300001090000300400200000100000000006000";
+
+// Measure how the parallel counter scales from 1 thread up to the number of cores
+int benchCount(const char *puzzleText){
+    Solver puzzle;
+    if(parsePuzzle(puzzleText != null ? puzzleText : BENCH_COUNT_PUZZLE, Classic, &puzzle)){
+        printf("invalid puzzle\n");
+        return 1;
+    }
+
+    int maxThreads = defaultThreadCount();
+    double baseline = 0;
+    printf("threads  solutions  seconds  speedup\n");
+    for(int threads = 1; threads <= maxThreads; threads++){
+        double start = nowSeconds();
+        long count = countSolutionsParallel(&puzzle, threads, 0);
+        double elapsed = nowSeconds() - start;
+        if(threads == 1)
+            baseline = elapsed;
+        printf("%7d  %9ld  %7.3f  %6.2fx\n", threads, count, elapsed, baseline / elapsed);
+    }
+
+    return 0;
+}
+
+// Turn a parsed 9x9 puzzle into a game board
+int **solverToBoard(const Solver *puzzle){
+    int **board = malloc(sizeof(int *) * BOARD_SIZE);
+    initBoard(&board);
+    for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+        board[i / BOARD_SIZE][i % BOARD_SIZE] = puzzle->cells[i] == 0 ? SPACE_VAL : puzzle->cells[i];
+    }
+
+    return board;
+}
+
+// Generate a board for a variant. The row by row generator gets stuck too
+// often once diagonals or jigsaw regions are added, so the solution comes
+// from the solver instead
+int **generateVariantBoard(int difficulty, const Ruleset *rules, int ***solutionBoard){
+    unsigned char empty[MAX_GRID_CELLS] = {0};
+    unsigned int seed = rand();
+    Solver solution;
+
+    initSolver(&solution, rules, empty);
+    fillRandomSolution(&solution, &seed);
+    *solutionBoard = solverToBoard(&solution);
+    int **board = solverToBoard(&solution);
+    removeValues(difficulty, &board, &seed);
+    return board;
+}
+
+// Compare keeping notes up to date move by move against recomputing them
+// with moveIsValid for every square and value after each move
+int benchNotes(const char *puzzleText){
+    Solver puzzle;
+    if(parsePuzzle(puzzleText != null ? puzzleText : BENCH_COUNT_PUZZLE, Classic, &puzzle) || puzzle.size != BOARD_SIZE){
+        printf("invalid puzzle\n");
+        return 1;
+    }
+
+    int numMoves = 1000000;
+    int numFullMoves = 10000;
+    int **board = solverToBoard(&puzzle);
+    int *moves = malloc(sizeof(int) * numMoves);
+    Notes notes;
+    Notes check;
+    unsigned int seed = 1;
+    unsigned int checksum = 0;
+
+    // Random squares and values, with 0 standing for a clear
+    for(int i = 0; i < numMoves; i++){
+        moves[i] = rand_r(&seed) % (BOARD_SIZE * BOARD_SIZE) * (BOARD_SIZE + 1) + rand_r(&seed) % (BOARD_SIZE + 1);
+    }
+
+    initNotes(&notes, board);
+    double start = nowSeconds();
+    for(int i = 0; i < numMoves; i++){
+        int cell = moves[i] / (BOARD_SIZE + 1);
+        int value = moves[i] % (BOARD_SIZE + 1);
+        int *square = &board[cell / BOARD_SIZE][cell % BOARD_SIZE];
+        value = value == 0 ? SPACE_VAL : value;
+        updateNotes(&notes, cell / BOARD_SIZE, cell % BOARD_SIZE, *square, value);
+        *square = value;
+    }
+    double incremental = (nowSeconds() - start) / numMoves;
+
+    initNotes(&check, board);
+    bool matches = memcmp(notes.candidates, check.candidates, sizeof(notes.candidates)) == 0;
+
+    start = nowSeconds();
+    for(int i = 0; i < numFullMoves; i++){
+        int cell = moves[i] / (BOARD_SIZE + 1);
+        int value = moves[i] % (BOARD_SIZE + 1);
+        board[cell / BOARD_SIZE][cell % BOARD_SIZE] = value == 0 ? SPACE_VAL : value;
+        for(int j = 0; j < BOARD_SIZE * BOARD_SIZE; j++){
+            for(int k = 1; k <= BOARD_SIZE; k++){
+                checksum += moveIsValid(j / BOARD_SIZE, j % BOARD_SIZE, k, board);
+            }
+        }
+    }
+    double full = (nowSeconds() - start) / numFullMoves;
+
+    printf("incremental: %8.1f ns/move (%d peers per update)\n", incremental * 1e9, NUM_PEERS);
+    printf("recompute:   %8.1f ns/move (%d checks per update)\n", full * 1e9,
+        BOARD_SIZE * BOARD_SIZE * BOARD_SIZE);
+    printf("speedup:     %8.1fx\n", full / incremental);
+    printf("notes match a full rebuild: %s\n", matches ? "yes" : "no");
+
+    free(moves);
+    freeBoard(board);
+    return checksum == 0 || !matches;
+}
+
+void *generateWorkerMain(void *arg){
+    GenerateJob *job = arg;
+    unsigned int seed = (unsigned int)time(null) ^ (unsigned int)(size_t)pthread_self();
+    char line[MAX_GRID_CELLS + 2];
+    Solver puzzle;
+
+    while(atomic_fetch_sub(&job->remaining, 1) > 0){
+        generateMinimal(&puzzle, job->rules, job->symmetry, &seed);
+        formatPuzzle(&puzzle, line);
+        strcat(line, "\n");
+        fputs(line, stdout);
+    }
+
+    return null;
+}
+
+// cdoku generate [-n COUNT] [-s none|rotational|mirror] [-r VARIANT] [-t THREADS]
+// Prints minimal 9x9 puzzles, one per line, and the rate to stderr
+int runGenerate(int argc, char **argv){
+    GenerateJob job;
+    int count = 1;
+    int numThreads = 1;
+    job.symmetry = No_Symmetry;
+    job.rules = getRuleset(BOX_SIZE, Classic);
+
+    for(int i = 0; i < argc; i += 2){
+        if(i + 1 >= argc)
+            return 1;
+
+        if(strcmp(argv[i], "-n") == 0){
+            count = atoi(argv[i + 1]);
+        }else if(strcmp(argv[i], "-t") == 0){
+            numThreads = atoi(argv[i + 1]);
+        }else if(strcmp(argv[i], "-r") == 0){
+            int variant = parseVariant(argv[i + 1]);
+            if(variant == 0)
+                return 1;
+            job.rules = getRuleset(BOX_SIZE, variant);
+        }else if(strcmp(argv[i], "-s") == 0){
+            if(strcmp(argv[i + 1], "rotational") == 0)
+                job.symmetry = Rotational;
+            else if(strcmp(argv[i + 1], "mirror") == 0)
+                job.symmetry = Mirror;
+            else if(strcmp(argv[i + 1], "none") != 0)
+                return 1;
+        }else{
+            return 1;
+        }
+    }
+
+    if(count < 1 || numThreads < 1)
+        return 1;
+
+    atomic_init(&job.remaining, count);
+    pthread_t *threads = malloc(sizeof(pthread_t) * numThreads);
+    double start = nowSeconds();
+
+    for(int i = 0; i < numThreads; i++){
+        pthread_create(&threads[i], null, generateWorkerMain, &job);
+    }
+    for(int i = 0; i < numThreads; i++){
+        pthread_join(threads[i], null);
+    }
+
+    double elapsed = nowSeconds() - start;
+    fprintf(stderr, "%d puzzles in %.3f s (%.1f per second per thread)\n", count, elapsed,
+        count / elapsed / numThreads);
+
+    free(threads);
+    return 0;
+}
+
+// Time minimal puzzle generation, and compare the incremental check against
+// counting solutions from scratch for every clue that is tried
+int benchMinimal(const char *symmetryName){
+    enum symmetryEnum symmetry = No_Symmetry;
+    if(symmetryName != null && strcmp(symmetryName, "rotational") == 0)
+        symmetry = Rotational;
+    else if(symmetryName != null && strcmp(symmetryName, "mirror") == 0)
+        symmetry = Mirror;
+
+    int numPuzzles = 200;
+    unsigned int seed = 1;
+    long totalClues = 0;
+    Solver puzzle;
+
+    double start = nowSeconds();
+    for(int i = 0; i < numPuzzles; i++){
+        generateMinimal(&puzzle, getRuleset(BOX_SIZE, Classic), symmetry, &seed);
+        for(int j = 0; j < puzzle.numCells; j++){
+            totalClues += puzzle.cells[j] != 0;
+        }
+    }
+    double incremental = nowSeconds() - start;
+
+    // The same removal order, but each attempt builds a new solver and
+    // counts up to two solutions
+    seed = 1;
+    start = nowSeconds();
+    for(int i = 0; i < numPuzzles; i++){
+        unsigned char empty[MAX_GRID_CELLS] = {0};
+        unsigned char cells[MAX_GRID_CELLS];
+        int order[MAX_GRID_CELLS];
+        int orbit[2];
+        Solver scratch;
+
+        initSolver(&puzzle, getRuleset(BOX_SIZE, Classic), empty);
+        fillRandomSolution(&puzzle, &seed);
+        memcpy(cells, puzzle.cells, puzzle.numCells);
+
+        for(int j = 0; j < puzzle.numCells; j++){
+            order[j] = j;
+        }
+        for(int j = puzzle.numCells - 1; j > 0; j--){
+            int k = rand_r(&seed) % (j + 1);
+            int swap = order[j];
+            order[j] = order[k];
+            order[k] = swap;
+        }
+
+        for(int j = 0; j < puzzle.numCells; j++){
+            if(cells[order[j]] == 0)
+                continue;
+
+            int orbitSize = symmetryOrbit(&puzzle, order[j], symmetry, orbit);
+            unsigned char saved[2];
+            for(int k = 0; k < orbitSize; k++){
+                saved[k] = cells[orbit[k]];
+                cells[orbit[k]] = 0;
+            }
+
+            initSolver(&scratch, getRuleset(BOX_SIZE, Classic), cells);
+            if(countSolutions(&scratch, 2, null) != 1){
+                for(int k = 0; k < orbitSize; k++){
+                    cells[orbit[k]] = saved[k];
+                }
+            }
+        }
+    }
+    double scratchTime = nowSeconds() - start;
+
+    printf("incremental: %7.1f puzzles/s, %.1f clues on average\n", numPuzzles / incremental,
+        (double)totalClues / numPuzzles);
+    printf("from scratch: %6.1f puzzles/s\n", numPuzzles / scratchTime);
+    printf("speedup: %.2fx\n", scratchTime / incremental);
+    return 0;
+}
+
+// Show that classic games don't pay for variant support. The classic and
+// generic peer table validators are timed against the original position
+// based check, and the specialized classic solver against the generic one
+// on the same rules
+int benchVariants(){
+    static Ruleset tableRules;
+    Solver puzzle;
+    Solver solution;
+    unsigned char empty[MAX_GRID_CELLS] = {0};
+    unsigned int seed = 1;
+    int numBoards = 20000;
+    long solveLimit = 200000;
+    long valid = 0;
+
+    tableRules = *getRuleset(BOX_SIZE, Classic);
+    tableRules.classic = false;
+
+    initSolver(&solution, getRuleset(BOX_SIZE, Classic), empty);
+    fillRandomSolution(&solution, &seed);
+    int **board = solverToBoard(&solution);
+
+    double start = nowSeconds();
+    for(int i = 0; i < numBoards; i++){
+        for(int j = 0; j < BOARD_SIZE * BOARD_SIZE; j++){
+            valid += moveIsValidByPosition(j / BOARD_SIZE, j % BOARD_SIZE, board[j / BOARD_SIZE][j % BOARD_SIZE], board);
+        }
+    }
+    double byPosition = (nowSeconds() - start) / numBoards;
+
+    start = nowSeconds();
+    for(int i = 0; i < numBoards; i++){
+        for(int j = 0; j < BOARD_SIZE * BOARD_SIZE; j++){
+            valid += moveIsValid(j / BOARD_SIZE, j % BOARD_SIZE, board[j / BOARD_SIZE][j % BOARD_SIZE], board);
+        }
+    }
+    double classic = (nowSeconds() - start) / numBoards;
+
+    start = nowSeconds();
+    for(int i = 0; i < numBoards; i++){
+        for(int j = 0; j < BOARD_SIZE * BOARD_SIZE; j++){
+            valid += moveIsValidForRules(j / BOARD_SIZE, j % BOARD_SIZE, board[j / BOARD_SIZE][j % BOARD_SIZE], board,
+                &tableRules);
+        }
+    }
+    double tables = (nowSeconds() - start) / numBoards;
+
+    parsePuzzle(BENCH_COUNT_PUZZLE, Classic, &puzzle);
+    start = nowSeconds();
+    long classicCount = countSolutions(&puzzle, solveLimit, null);
+    double classicSolve = nowSeconds() - start;
+
+    puzzle.rules = &tableRules;
+    start = nowSeconds();
+    long tableCount = countSolutions(&puzzle, solveLimit, null);
+    double tableSolve = nowSeconds() - start;
+
+    printf("validate a full board:\n");
+    printf("  by position:       %8.1f ns\n", byPosition * 1e9);
+    printf("  classic fast path: %8.1f ns\n", classic * 1e9);
+    printf("  unit tables:       %8.1f ns\n", tables * 1e9);
+    printf("count %ld solutions:\n", solveLimit);
+    printf("  classic fast path: %8.3f s\n", classicSolve);
+    printf("  unit tables:       %8.3f s\n", tableSolve);
+
+    freeBoard(board);
+    return valid != 3 * numBoards * BOARD_SIZE * BOARD_SIZE || classicCount != tableCount;
+}
+
+// cdoku bench NAME [ARG]
+int runBench(int argc, char **argv){
+    if(argc < 1)
+        return 1;
+
+    const char *arg = argc > 1 ? argv[1] : null;
+    if(strcmp(argv[0], "count") == 0)
+        return benchCount(arg);
+    if(strcmp(argv[0], "notes") == 0)
+        return benchNotes(arg);
+    if(strcmp(argv[0], "minimal") == 0)
+        return benchMinimal(arg);
+    if(strcmp(argv[0], "variants") == 0)
+        return benchVariants();
+
+    return 1;
+}
+
+// Turn "PATH" into a Unix socket address and "HOST:PORT" or ":PORT" into a
+// TCP one. Returns true if the address can't be used
+bool parseSocketAddress(const char *address, struct sockaddr_storage *addr, socklen_t *length){
+    const char *colon = strrchr(address, ':');
+    memset(addr, 0, sizeof(struct sockaddr_storage));
+
+    if(colon == null || strchr(address, '/') != null){
+        struct sockaddr_un *unixAddr = (struct sockaddr_un *)addr;
+        if(strlen(address) >= sizeof(unixAddr->sun_path))
+            return true;
+
+        unixAddr->sun_family = AF_UNIX;
+        strcpy(unixAddr->sun_path, address);
+        *length = sizeof(struct sockaddr_un);
+        return false;
+    }
+
+    char host[64] = "127.0.0.1";
+    size_t hostLength = colon - address;
+    if(hostLength >= sizeof(host))
+        return true;
+    if(hostLength > 0){
+        memcpy(host, address, hostLength);
+        host[hostLength] = '\0';
+    }
+
+    struct sockaddr_in *inetAddr = (struct sockaddr_in *)addr;
+    inetAddr->sin_family = AF_INET;
+    inetAddr->sin_port = htons(atoi(colon + 1));
+    if(inet_pton(AF_INET, host, &inetAddr->sin_addr) != 1)
+        return true;
+
+    *length = sizeof(struct sockaddr_in);
+    return false;
+}
+
+bool setNonBlocking(int fd){
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1;
+}
+
+// Let the process hold as many sockets as the hard limit allows
+void raiseFileLimit(){
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0){
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Fill a pool with boards for one difficulty
+void initPuzzlePool(PuzzlePool *pool, int difficulty, int size){
+    pool->size = size;
+    pool->next = 0;
+    pool->boards = malloc(sizeof(int **) * size);
+    pool->solutionBoards = malloc(sizeof(int **) * size);
+    for(int i = 0; i < size; i++){
+        pool->boards[i] = generateBoard(difficulty, &pool->solutionBoards[i]);
+    }
+}
+
+void freePuzzlePool(PuzzlePool *pool){
+    for(int i = 0; i < pool->size; i++){
+        freeBoard(pool->boards[i]);
+        freeBoard(pool->solutionBoards[i]);
+    }
+    free(pool->boards);
+    free(pool->solutionBoards);
+}
+
+// Hand out copies of the next board and its solution from the pool
+void takePuzzle(PuzzlePool *pool, int ***board, int ***solutionBoard){
+    *board = copyBoard(pool->boards[pool->next]);
+    *solutionBoard = copyBoard(pool->solutionBoards[pool->next]);
+    pool->next = (pool->next + 1) % pool->size;
+}
+
+// Add bytes to the session's pending output
+void queueOutput(Session *session, const char *data, size_t length){
+    if(session->outputLength + length > session->outputCapacity){
+        size_t capacity = session->outputCapacity == 0 ? READ_CHUNK_SIZE : session->outputCapacity;
+        while(capacity < session->outputLength + length){
+            capacity *= 2;
+        }
+        session->output = realloc(session->output, capacity);
+        session->outputCapacity = capacity;
+    }
+
+    memcpy(&session->output[session->outputLength], data, length);
+    session->outputLength += length;
+}
+
+void closeSession(GameServer *server, Session *session){
+    epoll_ctl(server->epollFd, EPOLL_CTL_DEL, session->fd, null);
+    close(session->fd);
+    freeBoard(session->board);
+    freeBoard(session->solutionBoard);
+    free(session->stats.notes);
+    free(session->output);
+    free(session);
+    server->numSessions--;
+}
+
+// Write as much pending output as the socket will take. Returns true if the
+// session was closed
+bool flushSession(GameServer *server, Session *session){
+    while(session->outputSent < session->outputLength){
+        ssize_t written = send(session->fd, &session->output[session->outputSent],
+            session->outputLength - session->outputSent, MSG_NOSIGNAL);
+        if(written < 0){
+            if(errno == EINTR)
+                continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK){
+                closeSession(server, session);
+                return true;
+            }
+            break;
+        }
+        session->outputSent += written;
+    }
+
+    bool drained = session->outputSent == session->outputLength;
+    if(drained){
+        session->outputSent = 0;
+        session->outputLength = 0;
+        if(session->state == Closing){
+            closeSession(server, session);
+            return true;
+        }
+    }
+
+    // Only ask for writability while there's a backlog, and stop reading
+    // from a client that isn't reading its replies until the backlog shrinks
+    unsigned int events = drained ? 0 : EPOLLOUT;
+    if(session->outputLength - session->outputSent < MAX_SESSION_BACKLOG)
+        events |= EPOLLIN;
+    if(events != session->events){
+        struct epoll_event event;
+        event.events = events;
+        event.data.ptr = session;
+        epoll_ctl(server->epollFd, EPOLL_CTL_MOD, session->fd, &event);
+        session->events = events;
+    }
+
+    return false;
+}
+
+// Move whatever the game wrote to the capture stream into the session's output
+void collectOutput(GameServer *server, Session *session){
+    fflush(server->capture);
+    queueOutput(session, server->captureBuffer, server->captureLength);
+    fseeko(server->capture, 0, SEEK_SET);
+}
+
+// True if a line is a save command whose name reaches outside the
+// current directory or would overwrite the score log or its index
+bool isRemotePathSave(const char *line){
+    Command command;
+    parseCommand(line, &command);
+    if(command.type != Save)
+        return false;
+
+    int prefixLength = strlen(SCORE_FILE_PREFIX);
+    return memchr(command.name, '/', command.nameLength) != null ||
+        (command.nameLength >= prefixLength && memcmp(command.name, SCORE_FILE_PREFIX, prefixLength) == 0);
+}
+
+// Run one line of input for a session through the same code the
+// interactive game uses, with output going to the session
+void handleSessionLine(GameServer *server, Session *session, const char *line){
+    gameOut = server->capture;
+
+    if(session->state == ChoosingDifficulty){
+        int difficulty = atoi(line);
+        if(difficulty < Easy || difficulty > Hard){
+            fprintf(gameOut, "\nInvalid choice\n\n%c ", INPUT_CHAR);
+        }else{
+            takePuzzle(&server->pools[difficulty - 1], &session->board, &session->solutionBoard);
+            initStats(&session->stats, difficulty);
+            session->state = Playing;
+            display(session->board);
+            fprintf(gameOut, "%s%c ", COMMAND_PROMPT, INPUT_CHAR);
+        }
+    }else if(isRemotePathSave(line)){
+        // Remote players only get to name files in the server's directory
+        fprintf(gameOut, "\nInvalid input\n%s%c ", COMMAND_PROMPT, INPUT_CHAR);
+    }else if(playTurn(session->board, session->solutionBoard, &session->stats, line)){
+        session->state = Closing;
+    }else{
+        fprintf(gameOut, "%s%c ", COMMAND_PROMPT, INPUT_CHAR);
+    }
+
+    collectOutput(server, session);
+    gameOut = null;
+}
+
+// Read everything available from a session and act on each complete line.
+// Returns true if the session was closed
+bool readSession(GameServer *server, Session *session){
+    char chunk[READ_CHUNK_SIZE];
+
+    // Past the backlog limit the rest of the input waits in the socket
+    while(session->outputLength - session->outputSent < MAX_SESSION_BACKLOG){
+        ssize_t received = recv(session->fd, chunk, sizeof(chunk), 0);
+        if(received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+            closeSession(server, session);
+            return true;
+        }
+        if(received < 0){
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        for(ssize_t i = 0; i < received && session->state != Closing; i++){
+            // Leave room for the newline and terminator the game expects
+            if(chunk[i] != '\n' && session->inputLength < SESSION_LINE_SIZE - 2){
+                session->input[session->inputLength++] = chunk[i];
+                continue;
+            }
+
+            if(chunk[i] != '\n'){
+                session->discardingLine = true;
+                continue;
+            }
+
+            // Lines that are too long can't be valid commands
+            if(session->discardingLine){
+                session->input[0] = '\0';
+                session->inputLength = 0;
+            }else if(session->inputLength > 0 && session->input[session->inputLength - 1] == '\r'){
+                session->inputLength--;
+            }
+            session->input[session->inputLength++] = '\n';
+            session->input[session->inputLength] = '\0';
+            handleSessionLine(server, session, session->input);
+            session->inputLength = 0;
+            session->discardingLine = false;
+        }
+    }
+
+    return flushSession(server, session);
+}
+
+void acceptSessions(GameServer *server){
+    while(true){
+        int fd = accept(server->listenFd, null, null);
+        if(fd < 0)
+            return;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setNonBlocking(fd);
+
+        Session *session = calloc(1, sizeof(Session));
+        session->fd = fd;
+        session->state = ChoosingDifficulty;
+        session->events = EPOLLIN;
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = session;
+        if(epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &event) != 0){
+            close(fd);
+            free(session);
+            continue;
+        }
+        server->numSessions++;
+
+        gameOut = server->capture;
+        fprintf(gameOut, "Welcome to Dylan's Sudoku!\n\n%s:\n\n", DIFFICULTY_MENU_TITLE);
+        for(int i = 0; i < DIFFICULTY_MENU_SIZE; i++){
+            fprintf(gameOut, "\t%d) %s\n", i + 1, DIFFICULTY_MENU_OPTIONS[i]);
+        }
+        fprintf(gameOut, "\n%c ", INPUT_CHAR);
+        collectOutput(server, session);
+        gameOut = null;
+        flushSession(server, session);
+    }
+}
+
+// Create a non-blocking listening socket for a Unix path or TCP port
+int openListener(const char *address){
+    struct sockaddr_storage addr;
+    socklen_t length;
+    if(parseSocketAddress(address, &addr, &length))
+        return -1;
+
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+
+    int one = 1;
+    if(addr.ss_family == AF_UNIX)
+        unlink(((struct sockaddr_un *)&addr)->sun_path);
+    else
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if(bind(fd, (struct sockaddr *)&addr, length) != 0 || listen(fd, SOMAXCONN) != 0 ||
+            setNonBlocking(fd)){
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// cdoku serve [-p POOL_SIZE] ADDRESS
+// Hosts any number of games from one process on an epoll event loop
+int runServe(int argc, char **argv){
+    int poolSize = DEFAULT_POOL_SIZE;
+    int first = 0;
+
+    if(argc >= 2 && strcmp(argv[0], "-p") == 0){
+        poolSize = atoi(argv[1]);
+        first = 2;
+    }
+
+    if(first >= argc || poolSize < 1)
+        return 1;
+
+    GameServer server;
+    memset(&server, 0, sizeof(GameServer));
+    server.listenFd = openListener(argv[first]);
+    if(server.listenFd < 0){
+        perror(argv[first]);
+        return COMMAND_FAILED;
+    }
+
+    raiseFileLimit();
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Generating %d boards per difficulty...\n", poolSize);
+    for(int i = 0; i < DIFFICULTY_MENU_SIZE; i++){
+        initPuzzlePool(&server.pools[i], Easy + i, poolSize);
+    }
+
+    // Games won by remote players go in the server's score log, written
+    // from another thread so the event loop never waits on the files
+    ScoreWriter writer;
+    startScoreWriter(&writer);
+    scoreWriter = &writer;
+    server.capture = open_memstream(&server.captureBuffer, &server.captureLength);
+    server.epollFd = epoll_create1(0);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = null;
+    epoll_ctl(server.epollFd, EPOLL_CTL_ADD, server.listenFd, &event);
+    printf("Listening on %s\n", argv[first]);
+
+    struct epoll_event events[MAX_EVENTS];
+    while(true){
+        int numEvents = epoll_wait(server.epollFd, events, MAX_EVENTS, -1);
+        if(numEvents < 0 && errno != EINTR)
+            break;
+
+        for(int i = 0; i < numEvents; i++){
+            Session *session = events[i].data.ptr;
+            if(session == null){
+                acceptSessions(&server);
+                continue;
+            }
+
+            if(events[i].events & (EPOLLERR | EPOLLHUP)){
+                closeSession(&server, session);
+            }else if(events[i].events & EPOLLIN){
+                readSession(&server, session);
+            }else if(events[i].events & EPOLLOUT){
+                flushSession(&server, session);
+            }
+        }
+    }
+
+    scoreWriter = null;
+    stopScoreWriter(&writer);
+    fclose(server.capture);
+    free(server.captureBuffer);
+    for(int i = 0; i < DIFFICULTY_MENU_SIZE; i++){
+        freePuzzlePool(&server.pools[i]);
+    }
+    close(server.epollFd);
+    close(server.listenFd);
+    return 0;
+}
+
+// Commands the load generator cycles through. None of them end the game
+const char *LOAD_COMMANDS[] = {"checking on\n", "5E 5\n", "hint\n", "1A 1\n",
+                               "checking off\n", "9I 9\n", "help\n", "3C 7\n"};
+int NUM_LOAD_COMMANDS = sizeof(LOAD_COMMANDS) / sizeof(LOAD_COMMANDS[0]);
+
+int compareDoubles(const void *a, const void *b){
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Send a load client's next line: a difficulty first, then game commands
+void sendLoadCommand(LoadClient *client){
+    const char *command = client->commandsSent == 0 ? "1\n" :
+        LOAD_COMMANDS[(client->commandsSent - 1) % NUM_LOAD_COMMANDS];
+    client->sentAt = nowSeconds();
+    client->tail[0] = client->tail[1] = '\0';
+    send(client->fd, command, strlen(command), MSG_NOSIGNAL);
+}
+
+// cdoku loadgen [-c CLIENTS] [-n COMMANDS] ADDRESS
+// Drives a server with many concurrent clients, each sending one command at
+// a time, and reports throughput and round trip latency
+int runLoadgen(int argc, char **argv){
+    int numClients = 100;
+    int numCommands = 100;
+    int first = 0;
+
+    while(first + 1 < argc && argv[first][0] == '-'){
+        if(strcmp(argv[first], "-c") == 0)
+            numClients = atoi(argv[first + 1]);
+        else if(strcmp(argv[first], "-n") == 0)
+            numCommands = atoi(argv[first + 1]);
+        else
+            return 1;
+        first += 2;
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t length;
+    if(first >= argc || numClients < 1 || numCommands < 1 || parseSocketAddress(argv[first], &addr, &length))
+        return 1;
+
+    raiseFileLimit();
+    signal(SIGPIPE, SIG_IGN);
+
+    int epollFd = epoll_create1(0);
+    LoadClient *clients = calloc(numClients, sizeof(LoadClient));
+    double *latencies = malloc(sizeof(double) * (size_t)numClients * ((size_t)numCommands + 1));
+    long numLatencies = 0;
+    int active = 0;
+
+    if(clients == null || latencies == null){
+        fprintf(stderr, "not enough memory for %d clients sending %d commands\n", numClients, numCommands);
+        free(latencies);
+        free(clients);
+        close(epollFd);
+        return COMMAND_FAILED;
+    }
+
+    for(int i = 0; i < numClients; i++){
+        clients[i].fd = socket(addr.ss_family, SOCK_STREAM, 0);
+        if(clients[i].fd < 0 || connect(clients[i].fd, (struct sockaddr *)&addr, length) != 0){
+            perror("connect");
+            for(int j = 0; j <= i; j++){
+                if(clients[j].fd >= 0)
+                    close(clients[j].fd);
+            }
+            free(latencies);
+            free(clients);
+            close(epollFd);
+            return COMMAND_FAILED;
+        }
+        setNonBlocking(clients[i].fd);
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = &clients[i];
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, clients[i].fd, &event);
+        active++;
+    }
+
+    double start = nowSeconds();
+    struct epoll_event events[MAX_EVENTS];
+    char chunk[READ_CHUNK_SIZE];
+
+    while(active > 0){
+        int numEvents = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        for(int i = 0; i < numEvents; i++){
+            LoadClient *client = events[i].data.ptr;
+            bool closed = false;
+            bool replied = false;
+
+            while(true){
+                ssize_t received = recv(client->fd, chunk, sizeof(chunk), 0);
+                if(received <= 0){
+                    closed = received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+                    break;
+                }
+
+                // Every reply ends with the input prompt
+                if(received >= 2){
+                    client->tail[0] = chunk[received - 2];
+                    client->tail[1] = chunk[received - 1];
+                }else{
+                    client->tail[0] = client->tail[1];
+                    client->tail[1] = chunk[0];
+                }
+                replied = client->tail[0] == INPUT_CHAR && client->tail[1] == ' ';
+            }
+
+            if(replied && !closed){
+                if(!client->connected)
+                    client->connected = true;
+                else
+                    latencies[numLatencies++] = nowSeconds() - client->sentAt;
+
+                if(client->commandsSent <= numCommands){
+                    sendLoadCommand(client);
+                    client->commandsSent++;
+                    continue;
+                }
+                closed = true;
+            }
+
+            if(closed){
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, client->fd, null);
+                close(client->fd);
+                active--;
+            }
+        }
+    }
+
+    double elapsed = nowSeconds() - start;
+    qsort(latencies, numLatencies, sizeof(double), compareDoubles);
+
+    printf("clients: %d\n", numClients);
+    printf("commands: %ld in %.3f s (%.0f commands/s)\n", numLatencies, elapsed, numLatencies / elapsed);
+    if(numLatencies > 0){
+        printf("latency p50: %.3f ms\n", latencies[numLatencies / 2] * 1000);
+        printf("latency p90: %.3f ms\n", latencies[numLatencies * 9 / 10] * 1000);
+        printf("latency p99: %.3f ms\n", latencies[numLatencies * 99 / 100] * 1000);
+        printf("latency max: %.3f ms\n", latencies[numLatencies - 1] * 1000);
+    }
+
+    free(latencies);
+    free(clients);
+    close(epollFd);
+    return 0;
+}
+
+const char *BOT_ACTION_NAMES[] = {"correct move", "mistake", "hint", "checking on", "save", "new board"};
+
+void recordLatency(LatencyHistogram *histogram, double seconds){
+    long nanoseconds = (long)(seconds * 1e9);
+    int bucket = nanoseconds < 2 ? 0 : 63 - __builtin_clzl(nanoseconds);
+    if(bucket >= LATENCY_BUCKETS)
+        bucket = LATENCY_BUCKETS - 1;
+
+    histogram->counts[bucket]++;
+    histogram->total++;
+    histogram->sumSeconds += seconds;
+    if(seconds > histogram->maxSeconds)
+        histogram->maxSeconds = seconds;
+}
+
+void mergeHistogram(LatencyHistogram *into, const LatencyHistogram *from){
+    for(int i = 0; i < LATENCY_BUCKETS; i++){
+        into->counts[i] += from->counts[i];
+    }
+    into->total += from->total;
+    into->sumSeconds += from->sumSeconds;
+    if(from->maxSeconds > into->maxSeconds)
+        into->maxSeconds = from->maxSeconds;
+}
+
+// Write a number of nanoseconds in the largest unit it fills
+void formatNanoseconds(double nanoseconds, char *text, size_t size){
+    if(nanoseconds >= 1e9)
+        snprintf(text, size, "%.3g s", nanoseconds / 1e9);
+    else if(nanoseconds >= 1e6)
+        snprintf(text, size, "%.3g ms", nanoseconds / 1e6);
+    else if(nanoseconds >= 1e3)
+        snprintf(text, size, "%.3g us", nanoseconds / 1e3);
+    else
+        snprintf(text, size, "%.3g ns", nanoseconds);
+}
+
+void printHistogram(const char *name, const LatencyHistogram *histogram){
+    if(histogram->total == 0)
+        return;
+
+    printf("%s: %ld commands, mean %.3f us, max %.3f us\n", name, histogram->total,
+        histogram->sumSeconds / histogram->total * 1e6, histogram->maxSeconds * 1e6);
+
+    long largest = 0;
+    int first = LATENCY_BUCKETS;
+    int last = 0;
+    for(int i = 0; i < LATENCY_BUCKETS; i++){
+        if(histogram->counts[i] == 0)
+            continue;
+        if(i < first)
+            first = i;
+        last = i;
+        if(histogram->counts[i] > largest)
+            largest = histogram->counts[i];
+    }
+
+    for(int i = first; i <= last; i++){
+        char low[16];
+        char high[16];
+        char bar[HISTOGRAM_WIDTH + 1];
+        formatNanoseconds((double)(1L << i), low, sizeof(low));
+        formatNanoseconds((double)(1L << (i + 1)), high, sizeof(high));
+
+        // Any bucket that isn't empty gets at least one mark
+        int width = (int)(histogram->counts[i] * HISTOGRAM_WIDTH / largest);
+        if(width == 0 && histogram->counts[i] > 0)
+            width = 1;
+        memset(bar, '#', width);
+        bar[width] = '\0';
+
+        printf("  %8s - %-8s %10ld%s%s\n", low, high, histogram->counts[i], width > 0 ? " " : "", bar);
+    }
+}
+
+// Pick a square at random, starting the scan at a random square, whose
+// value doesn't match the solution. Only empty squares count if emptyOnly
+bool pickBotSquare(Bot *bot, unsigned int *seed, bool emptyOnly, int *row, int *col){
+    int start = rand_r(seed) % (BOARD_SIZE * BOARD_SIZE);
+    for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+        int cell = (start + i) % (BOARD_SIZE * BOARD_SIZE);
+        int value = bot->board[cell / BOARD_SIZE][cell % BOARD_SIZE];
+        if(value == bot->solutionBoard[cell / BOARD_SIZE][cell % BOARD_SIZE])
+            continue;
+        if(emptyOnly && value != SPACE_VAL)
+            continue;
+
+        *row = cell / BOARD_SIZE;
+        *col = cell % BOARD_SIZE;
+        return true;
+    }
+    return false;
+}
+
+// Play a game command for a bot, timing it. Returns true once the game is won
+bool botCommand(SimWorker *worker, Bot *bot, enum botActionEnum action, const char *move){
+    double start = nowSeconds();
+    bool isOver = playTurn(bot->board, bot->solutionBoard, &bot->stats, move);
+    recordLatency(&worker->histograms[action], nowSeconds() - start);
+    worker->commands++;
+    return isOver;
+}
+
+// Start a new game for a bot the way a player would: generate a board and,
+// if the bot makes mistakes, turn on checking to catch them
+void startBotGame(SimWorker *worker, Bot *bot){
+    int difficulty = rand_r(&worker->seed) % Hard + Easy;
+
+    double start = nowSeconds();
+    bot->board = generateBoardCancellable(difficulty, &bot->solutionBoard, &worker->seed, null);
+    recordLatency(&worker->histograms[Bot_Generate], nowSeconds() - start);
+
+    initStats(&bot->stats, difficulty);
+    bot->turns = 0;
+    if(worker->sim->weights[Bot_Mistake] > 0)
+        botCommand(worker, bot, Bot_Check_Toggle, "checking on");
+}
+
+void finishBotGame(SimWorker *worker, Bot *bot){
+    worker->totalScore += calculateScore(&bot->stats);
+    worker->games++;
+    freeBoard(bot->board);
+    freeBoard(bot->solutionBoard);
+    bot->board = null;
+    bot->solutionBoard = null;
+    bot->gamesLeft--;
+}
+
+// Take one turn for a bot. Every saveEvery turns the game is saved, other
+// turns are a correct move, a mistake or a hint picked by the strategy mix
+void takeBotTurn(SimWorker *worker, Bot *bot){
+    Simulation *sim = worker->sim;
+    char move[MOVE_INPUT_SIZE];
+
+    if(bot->board == null){
+        startBotGame(worker, bot);
+        return;
+    }
+
+    bot->turns++;
+    if(sim->saveEvery > 0 && bot->turns % sim->saveEvery == 0){
+        char filename[PATH_MAX];
+        snprintf(filename, sizeof(filename), "%s/cdoku-sim-%d-%d.sav", sim->saveDir, (int)getpid(), bot->id);
+
+        double start = nowSeconds();
+        if(saveGame(bot->board, bot->solutionBoard, &bot->stats, filename))
+            worker->failedSaves++;
+        recordLatency(&worker->histograms[Bot_Save], nowSeconds() - start);
+        worker->commands++;
+        return;
+    }
+
+    int pick = rand_r(&worker->seed) % sim->totalWeight;
+    enum botActionEnum action = Bot_Correct;
+    if(pick >= sim->weights[Bot_Correct])
+        action = pick < sim->weights[Bot_Correct] + sim->weights[Bot_Mistake] ? Bot_Mistake : Bot_Hint;
+
+    int row;
+    int col;
+    if(action == Bot_Mistake && pickBotSquare(bot, &worker->seed, true, &row, &col)){
+        int wrong = rand_r(&worker->seed) % (BOARD_SIZE - 1) + 1;
+        if(wrong >= bot->solutionBoard[row][col])
+            wrong++;
+        snprintf(move, sizeof(move), "%c%c %d", ROW_NAMES[row], COL_NAMES[col], wrong);
+    }else if(action == Bot_Hint){
+        snprintf(move, sizeof(move), "hint");
+    }else{
+        // Wrong values that got past the checks are cleared first. Writing
+        // the right value over them could be refused by checking when
+        // another wrong square holds it
+        action = Bot_Correct;
+        if(!pickBotSquare(bot, &worker->seed, false, &row, &col))
+            return;
+        int value = bot->board[row][col] == SPACE_VAL ? bot->solutionBoard[row][col] : 0;
+        snprintf(move, sizeof(move), "%c%c %d", ROW_NAMES[row], COL_NAMES[col], value);
+    }
+
+    if(botCommand(worker, bot, action, move))
+        finishBotGame(worker, bot);
+}
+
+void *simWorkerMain(void *arg){
+    SimWorker *worker = arg;
+
+    // Bots play through the same output calls as people, which go nowhere
+    gameOut = fopen("/dev/null", "w");
+    gameSeed = rand_r(&worker->seed);
+
+    int active = worker->numBots;
+    while(active > 0){
+        active = 0;
+        for(int i = 0; i < worker->numBots; i++){
+            Bot *bot = &worker->bots[i];
+            if(bot->gamesLeft == 0)
+                continue;
+            takeBotTurn(worker, bot);
+            active += bot->gamesLeft > 0;
+        }
+    }
+
+    fclose(gameOut);
+    gameOut = null;
+    return null;
+}
+
+long maxResidentKilobytes(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// cdoku simulate [-b BOTS] [-g GAMES] [-t THREADS] [-m CORRECT,MISTAKE,HINT] [-s SAVE_EVERY] [-o DIR]
+// Plays GAMES games with each of BOTS simulated players spread over THREADS
+// threads, going through the same command handling as the interactive game
+int runSimulate(int argc, char **argv){
+    Simulation sim = {.gamesPerBot = 10, .saveEvery = 20, .weights = {85, 10, 5}, .saveDir = "/tmp"};
+    int numBots = 64;
+    int numThreads = defaultThreadCount();
+    int first = 0;
+
+    while(first + 1 < argc && argv[first][0] == '-'){
+        if(strcmp(argv[first], "-b") == 0)
+            numBots = atoi(argv[first + 1]);
+        else if(strcmp(argv[first], "-g") == 0)
+            sim.gamesPerBot = atoi(argv[first + 1]);
+        else if(strcmp(argv[first], "-t") == 0)
+            numThreads = atoi(argv[first + 1]);
+        else if(strcmp(argv[first], "-s") == 0)
+            sim.saveEvery = atoi(argv[first + 1]);
+        else if(strcmp(argv[first], "-o") == 0)
+            sim.saveDir = argv[first + 1];
+        else if(strcmp(argv[first], "-m") != 0 ||
+                sscanf(argv[first + 1], "%d,%d,%d", &sim.weights[Bot_Correct], &sim.weights[Bot_Mistake],
+                    &sim.weights[Bot_Hint]) != 3)
+            return 1;
+        first += 2;
+    }
+
+    sim.totalWeight = sim.weights[Bot_Correct] + sim.weights[Bot_Mistake] + sim.weights[Bot_Hint];
+    if(first != argc || numBots < 1 || sim.gamesPerBot < 1 || sim.weights[Bot_Correct] < 1 ||
+            sim.weights[Bot_Mistake] < 0 || sim.weights[Bot_Hint] < 0)
+        return 1;
+    if(numThreads < 1)
+        numThreads = 1;
+    if(numThreads > numBots)
+        numThreads = numBots;
+
+    Bot *bots = calloc(numBots, sizeof(Bot));
+    SimWorker *workers = calloc(numThreads, sizeof(SimWorker));
+    for(int i = 0; i < numBots; i++){
+        bots[i].id = i;
+        bots[i].gamesLeft = sim.gamesPerBot;
+    }
+
+    long baseKilobytes = maxResidentKilobytes();
+    double start = nowSeconds();
+    int nextBot = 0;
+    for(int i = 0; i < numThreads; i++){
+        workers[i].sim = &sim;
+        workers[i].bots = &bots[nextBot];
+        workers[i].numBots = numBots / numThreads + (i < numBots % numThreads);
+        workers[i].seed = rand();
+        nextBot += workers[i].numBots;
+        pthread_create(&workers[i].thread, null, simWorkerMain, &workers[i]);
+    }
+
+    LatencyHistogram histograms[NUM_BOT_ACTIONS];
+    memset(histograms, '\0', sizeof(histograms));
+    long games = 0;
+    long commands = 0;
+    long totalScore = 0;
+    long failedSaves = 0;
+    for(int i = 0; i < numThreads; i++){
+        pthread_join(workers[i].thread, null);
+        games += workers[i].games;
+        commands += workers[i].commands;
+        totalScore += workers[i].totalScore;
+        failedSaves += workers[i].failedSaves;
+        for(int j = 0; j < NUM_BOT_ACTIONS; j++){
+            mergeHistogram(&histograms[j], &workers[i].histograms[j]);
+        }
+    }
+    double elapsed = nowSeconds() - start;
+
+    if(sim.saveEvery > 0){
+        for(int i = 0; i < numBots; i++){
+            char filename[PATH_MAX];
+            snprintf(filename, sizeof(filename), "%s/cdoku-sim-%d-%d.sav", sim.saveDir, (int)getpid(), i);
+            unlink(filename);
+        }
+    }
+
+    printf("bots: %d on %d threads, %d games each\n", numBots, numThreads, sim.gamesPerBot);
+    printf("games: %ld in %.3f s (%.1f games/s)\n", games, elapsed, games / elapsed);
+    printf("commands: %ld (%.0f commands/s)\n", commands, commands / elapsed);
+    printf("average score: %.1f/%d\n", (double)totalScore / games, BASE_SCORE);
+    if(failedSaves > 0)
+        printf("failed saves: %ld\n", failedSaves);
+    printf("memory high-water: %ld KB (%ld KB before the bots started)\n", maxResidentKilobytes(), baseKilobytes);
+    for(int i = 0; i < NUM_BOT_ACTIONS; i++){
+        printf("\n");
+        printHistogram(BOT_ACTION_NAMES[i], &histograms[i]);
+    }
+
+    free(workers);
+    free(bots);
+    return 0;
+}
+
+// Packed puzzle files hold 9x9 puzzles in far less room than text lines.
+// The layout, with all numbers little endian:
+//
+//   header:  "CDKP", version, variant, puzzles per block (2 bytes)
+//   blocks:  number of puzzles in the block (2 bytes), then for each puzzle
+//            an 81 bit map of the squares holding clues followed by the
+//            clue values, two to a byte, in square order
+//   end:     a block of 0 puzzles
+//   index:   the file offset of each block (8 bytes each)
+//   trailer: offset of the index (8 bytes), number of puzzles (8 bytes), "CDKI"
+//
+// A file can be read straight through without the index, which is only
+// needed to jump to a puzzle by number
+
+// Pack the clues of a puzzle into record. Returns the number of bytes used
+int packPuzzle(const unsigned char *cells, unsigned char *record){
+    unsigned char *values = record + PACK_BITMAP_BYTES;
+    int numClues = 0;
+
+    memset(record, 0, PACK_RECORD_MAX);
+    for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+        if(cells[i] == 0)
+            continue;
+
+        record[i / 8] |= 1 << (i % 8);
+        values[numClues / 2] |= cells[i] << (4 * (numClues % 2));
+        numClues++;
+    }
+
+    return PACK_BITMAP_BYTES + (numClues + 1) / 2;
+}
+
+// Write out the puzzles collected so far as a block
+bool flushPackBlock(PackWriter *writer){
+    if(writer->blockPuzzles == 0)
+        return false;
+
+    if(writer->numBlocks == writer->blockCapacity){
+        writer->blockCapacity = writer->blockCapacity == 0 ? 64 : writer->blockCapacity * 2;
+        writer->blockOffsets = realloc(writer->blockOffsets, sizeof(long long) * writer->blockCapacity);
+    }
+    writer->blockOffsets[writer->numBlocks++] = writer->offset;
+
+    putLittleEndian(writer->block, writer->blockPuzzles, 2);
+    if(fwrite(writer->block, 1, writer->blockLength, writer->fp) != (size_t)writer->blockLength)
+        return true;
+
+    writer->offset += writer->blockLength;
+    writer->blockLength = 2;
+    writer->blockPuzzles = 0;
+    return false;
+}
+
+bool openPackWriter(PackWriter *writer, FILE *fp, int variant){
+    unsigned char header[PACK_HEADER_SIZE];
+
+    memset(writer, 0, sizeof(PackWriter));
+    writer->fp = fp;
+    writer->blockLength = 2;
+
+    memcpy(header, PACK_MAGIC, 4);
+    header[4] = PACK_VERSION;
+    header[5] = variant;
+    putLittleEndian(header + 6, PACK_BLOCK_PUZZLES, 2);
+    writer->offset = PACK_HEADER_SIZE;
+    return fwrite(header, 1, PACK_HEADER_SIZE, fp) != PACK_HEADER_SIZE;
+}
+
+bool writePackedPuzzle(PackWriter *writer, const unsigned char *cells){
+    writer->blockLength += packPuzzle(cells, writer->block + writer->blockLength);
+    writer->blockPuzzles++;
+    writer->numPuzzles++;
+
+    if(writer->blockPuzzles == PACK_BLOCK_PUZZLES)
+        return flushPackBlock(writer);
+    return false;
+}
+
+// Write the last block, the end marker, the block index and the trailer
+bool closePackWriter(PackWriter *writer){
+    unsigned char bytes[PACK_TRAILER_SIZE];
+    bool failed = flushPackBlock(writer);
+
+    putLittleEndian(bytes, 0, 2);
+    failed |= fwrite(bytes, 1, 2, writer->fp) != 2;
+    long long indexOffset = writer->offset + 2;
+
+    for(int i = 0; i < writer->numBlocks; i++){
+        putLittleEndian(bytes, writer->blockOffsets[i], 8);
+        failed |= fwrite(bytes, 1, 8, writer->fp) != 8;
+    }
+
+    putLittleEndian(bytes, indexOffset, 8);
+    putLittleEndian(bytes + 8, writer->numPuzzles, 8);
+    memcpy(bytes + 16, PACK_INDEX_MAGIC, 4);
+    failed |= fwrite(bytes, 1, PACK_TRAILER_SIZE, writer->fp) != PACK_TRAILER_SIZE;
+
+    free(writer->blockOffsets);
+    writer->blockOffsets = null;
+    return failed;
+}
+
+bool openPackReader(PackReader *reader, FILE *fp){
+    unsigned char header[PACK_HEADER_SIZE];
+
+    memset(reader, 0, sizeof(PackReader));
+    reader->fp = fp;
+    reader->numPuzzles = -1;
+    if(fread(header, 1, PACK_HEADER_SIZE, fp) != PACK_HEADER_SIZE || memcmp(header, PACK_MAGIC, 4) != 0 ||
+            header[4] != PACK_VERSION || header[5] < Classic || header[5] > Jigsaw)
+        return true;
+
+    reader->variant = header[5];
+    reader->puzzlesPerBlock = getLittleEndian(header + 6, 2);
+    return reader->puzzlesPerBlock == 0;
+}
+
+// Read the next puzzle into cells. Returns 1 for a puzzle, 0 at the end of
+// the file and -1 if the file is cut short or corrupt
+int readNextPuzzle(PackReader *reader, unsigned char *cells){
+    unsigned char record[PACK_RECORD_MAX];
+
+    if(reader->puzzlesLeftInBlock == 0){
+        if(fread(record, 1, 2, reader->fp) != 2)
+            return -1;
+        reader->puzzlesLeftInBlock = getLittleEndian(record, 2);
+        if(reader->puzzlesLeftInBlock == 0)
+            return 0;
+    }
+
+    if(fread(record, 1, PACK_BITMAP_BYTES, reader->fp) != PACK_BITMAP_BYTES)
+        return -1;
+
+    int numClues = 0;
+    for(int i = 0; i < PACK_BITMAP_BYTES; i++){
+        numClues += __builtin_popcount(record[i]);
+    }
+    if(numClues > BOARD_SIZE * BOARD_SIZE)
+        return -1;
+
+    unsigned char *values = record + PACK_BITMAP_BYTES;
+    int valueBytes = (numClues + 1) / 2;
+    if(fread(values, 1, valueBytes, reader->fp) != (size_t)valueBytes)
+        return -1;
+
+    int clue = 0;
+    for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+        if(!(record[i / 8] & (1 << (i % 8)))){
+            cells[i] = 0;
+            continue;
+        }
+
+        cells[i] = (values[clue / 2] >> (4 * (clue % 2))) & 0xf;
+        if(cells[i] == 0 || cells[i] > BOARD_SIZE)
+            return -1;
+        clue++;
+    }
+
+    reader->puzzlesLeftInBlock--;
+    return 1;
+}
+
+// Read the trailer to find out how many puzzles the file holds
+bool readPackTrailer(PackReader *reader, long long *indexOffset){
+    unsigned char trailer[PACK_TRAILER_SIZE];
+
+    if(fseeko(reader->fp, -PACK_TRAILER_SIZE, SEEK_END) != 0 ||
+            fread(trailer, 1, PACK_TRAILER_SIZE, reader->fp) != PACK_TRAILER_SIZE ||
+            memcmp(trailer + 16, PACK_INDEX_MAGIC, 4) != 0)
+        return true;
+
+    *indexOffset = getLittleEndian(trailer, 8);
+    reader->numPuzzles = getLittleEndian(trailer + 8, 8);
+    return false;
+}
+
+// Jump to puzzle number (counting from 0) using the block index, so the
+// next readNextPuzzle returns it. Only the block holding it is read
+bool seekPackedPuzzle(PackReader *reader, long long number){
+    unsigned char bytes[8];
+    long long indexOffset;
+
+    if(readPackTrailer(reader, &indexOffset) || number < 0 || number >= reader->numPuzzles)
+        return true;
+
+    if(fseeko(reader->fp, indexOffset + 8 * (number / reader->puzzlesPerBlock), SEEK_SET) != 0 ||
+            fread(bytes, 1, 8, reader->fp) != 8 ||
+            fseeko(reader->fp, getLittleEndian(bytes, 8), SEEK_SET) != 0)
+        return true;
+
+    reader->puzzlesLeftInBlock = 0;
+    unsigned char cells[BOARD_SIZE * BOARD_SIZE];
+    for(long long i = 0; i < number % reader->puzzlesPerBlock; i++){
+        if(readNextPuzzle(reader, cells) != 1)
+            return true;
+    }
+    return false;
+}
+
+// Fill the empty squares of a puzzle with its first solution. Returns true
+// if it has none
+bool solvePuzzle(Solver *s){
+    unsigned int candidates;
+    int cell = solverPickCell(s, &candidates);
+
+    if(cell == -1)
+        return false;
+
+    while(candidates){
+        int value = __builtin_ctz(candidates);
+        candidates &= candidates - 1;
+
+        solverPlace(s, cell, value);
+        if(!solvePuzzle(s))
+            return false;
+        solverClear(s, cell);
+    }
+
+    return true;
+}
+
+// Pick a difficulty for a puzzle that didn't come from the generator by
+// comparing its clue count against what each difficulty leaves behind
+int difficultyForClues(int numClues){
+    if(numClues >= BOARD_SIZE * BOARD_SIZE - EASY_REMOVE)
+        return Easy;
+    if(numClues >= BOARD_SIZE * BOARD_SIZE - MED_REMOVE)
+        return Medium;
+    return Hard;
+}
+
+// Start a game from a puzzle in a packed file. The player names the file
+// and the puzzle number, and the solution board comes from the solver
+bool loadPuzzle(int ***board, int ***solutionBoard, GameStats *stats){
+    char input[256];
+    PackReader reader;
+    Solver puzzle;
+    unsigned char cells[BOARD_SIZE * BOARD_SIZE];
+    long long indexOffset;
+    long long number;
+    memset(stats, '\0', sizeof(GameStats));
+
+    // Do an fgets to clear the input buffer
+    printf(" ");
+    fgets(input, sizeof(input), stdin);
+    printf("\nType the name of the puzzle file you'd like to load:\n\n");
+    printf("%c ", INPUT_CHAR);
+    if(fgets(input, sizeof(input), stdin) == null)
+        return true;
+    input[strcspn(input, "\n")] = '\0';
+
+    FILE *fp = fopen(input, "rb");
+    if(fp == null)
+        return true;
+
+    if(openPackReader(&reader, fp) || readPackTrailer(&reader, &indexOffset) || reader.numPuzzles == 0){
+        fclose(fp);
+        return true;
+    }
+
+    printf("\nType the number of the puzzle to play (1 to %lld):\n\n", reader.numPuzzles);
+    printf("%c ", INPUT_CHAR);
+    // Accept "#N" as well as a plain number
+    if(fgets(input, sizeof(input), stdin) == null || sscanf(input + strspn(input, " #"), "%lld", &number) != 1){
+        fclose(fp);
+        return true;
+    }
+
+    bool failed = seekPackedPuzzle(&reader, number - 1) || readNextPuzzle(&reader, cells) != 1 ||
+        initSolver(&puzzle, getRuleset(BOX_SIZE, reader.variant), cells);
+    fclose(fp);
+    if(failed)
+        return true;
+
+    int numClues = 0;
+    for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+        numClues += cells[i] != 0;
+    }
+
+    *board = solverToBoard(&puzzle);
+    if(solvePuzzle(&puzzle)){
+        freeBoard(*board);
+        *board = null;
+        return true;
+    }
+    *solutionBoard = solverToBoard(&puzzle);
+
+    initStats(stats, difficultyForClues(numClues));
+    stats->variant = reader.variant;
+    return false;
+}
+
+// Open the input and output of a conversion, "-" or a missing name meaning
+// stdin or stdout. Both get large buffers since whole sets stream through
+bool openConversionFiles(int argc, char **argv, bool packedInput, FILE **in, FILE **out){
+    *in = stdin;
+    *out = stdout;
+    if(argc > 0 && strcmp(argv[0], "-") != 0){
+        *in = fopen(argv[0], packedInput ? "rb" : "r");
+        if(*in == null){
+            perror(argv[0]);
+            return true;
+        }
+    }
+    if(argc > 1 && strcmp(argv[1], "-") != 0){
+        *out = fopen(argv[1], packedInput ? "w" : "wb");
+        if(*out == null){
+            perror(argv[1]);
+            return true;
+        }
+    }
+
+    setvbuf(*in, null, _IOFBF, PACK_IO_BUFFER_SIZE);
+    setvbuf(*out, null, _IOFBF, PACK_IO_BUFFER_SIZE);
+    return false;
+}
+
+void closeConversionFiles(FILE *in, FILE *out){
+    if(in != null && in != stdin)
+        fclose(in);
+    if(out != null && out != stdout)
+        fclose(out);
+}
+
+// cdoku pack [-r VARIANT] [IN [OUT]]
+// Converts a file of 81 character puzzle lines into a packed puzzle file
+int runPack(int argc, char **argv){
+    int variant = Classic;
+    int first = 0;
+
+    if(argc >= 2 && strcmp(argv[0], "-r") == 0){
+        variant = parseVariant(argv[1]);
+        if(variant == 0)
+            return 1;
+        first = 2;
+    }
+
+    if(argc - first > 2)
+        return 1;
+
+    FILE *in;
+    FILE *out;
+    if(openConversionFiles(argc - first, argv + first, false, &in, &out)){
+        closeConversionFiles(in, out);
+        return COMMAND_FAILED;
+    }
+
+    PackWriter writer;
+    char line[PUZZLE_LINE_SIZE];
+    long lineNumber = 0;
+    long skipped = 0;
+    bool failed = openPackWriter(&writer, out, variant);
+    double start = nowSeconds();
+
+    while(!failed && fgets(line, sizeof(line), in) != null){
+        Solver puzzle;
+        lineNumber++;
+        if(line[0] == '\n')
+            continue;
+
+        // Only 9x9 puzzles fit the clue map
+        if(parsePuzzle(line, variant, &puzzle) || puzzle.size != BOARD_SIZE){
+            fprintf(stderr, "line %ld: invalid puzzle\n", lineNumber);
+            skipped++;
+            continue;
+        }
+        failed = writePackedPuzzle(&writer, puzzle.cells);
+    }
+
+    failed |= closePackWriter(&writer);
+    failed |= fflush(out) != 0;
+    double elapsed = nowSeconds() - start;
+
+    if(failed){
+        fprintf(stderr, "write failed\n");
+    }else{
+        fprintf(stderr, "packed %lld puzzles into %lld bytes (%.1f bytes per puzzle) in %.3f s\n",
+            writer.numPuzzles, writer.offset + 2 + 8LL * writer.numBlocks + PACK_TRAILER_SIZE,
+            writer.numPuzzles > 0 ? (double)writer.offset / writer.numPuzzles : 0.0, elapsed);
+        if(skipped > 0)
+            fprintf(stderr, "skipped %ld invalid lines\n", skipped);
+    }
+
+    closeConversionFiles(in, out);
+    return failed ? COMMAND_FAILED : 0;
+}
+
+// cdoku unpack [-n NUMBER] [IN [OUT]]
+// Converts a packed puzzle file back to one puzzle per line, or prints just
+// puzzle NUMBER (counting from 1) found through the block index
+int runUnpack(int argc, char **argv){
+    long long number = 0;
+    int first = 0;
+
+    if(argc >= 2 && strcmp(argv[0], "-n") == 0){
+        number = atoll(argv[1]);
+        if(number < 1)
+            return 1;
+        first = 2;
+    }
+
+    if(argc - first > 2)
+        return 1;
+
+    FILE *in;
+    FILE *out;
+    PackReader reader;
+    if(openConversionFiles(argc - first, argv + first, true, &in, &out)){
+        closeConversionFiles(in, out);
+        return COMMAND_FAILED;
+    }
+    if(openPackReader(&reader, in)){
+        fprintf(stderr, "not a packed puzzle file\n");
+        closeConversionFiles(in, out);
+        return COMMAND_FAILED;
+    }
+
+    unsigned char cells[BOARD_SIZE * BOARD_SIZE];
+    char line[BOARD_SIZE * BOARD_SIZE + 2];
+    long long count = 0;
+    int result;
+
+    if(number > 0 && seekPackedPuzzle(&reader, number - 1)){
+        fprintf(stderr, "no puzzle %lld\n", number);
+        closeConversionFiles(in, out);
+        return COMMAND_FAILED;
+    }
+
+    while((result = readNextPuzzle(&reader, cells)) == 1){
+        for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+            line[i] = cells[i] == 0 ? '.' : cells[i] + ASCII_NUM_DIFF;
+        }
+        line[BOARD_SIZE * BOARD_SIZE] = '\n';
+        fwrite(line, 1, BOARD_SIZE * BOARD_SIZE + 1, out);
+        count++;
+
+        if(number > 0)
+            break;
+    }
+
+    if(result == -1)
+        fprintf(stderr, "packed file is cut short or corrupt after %lld puzzles\n", count);
+
+    closeConversionFiles(in, out);
+    return result == -1 ? COMMAND_FAILED : 0;
+}
+
+// Check a save's stats and boards. The solution has to be a complete grid
+// that follows the variant's rules. Squares the player has filled in are
+// compared against it, but wrong or clashing ones are only reported since
+// a game in progress can hold mistakes. Returns true if the save is invalid
+bool checkSave(SaveFile *save, char *detail, size_t size){
+    GameStats *stats = &save->stats;
+    unsigned char cells[BOARD_SIZE * BOARD_SIZE];
+    Solver solver;
+
+    if(checkSaveStats(stats)){
+        snprintf(detail, size, "stats out of range");
+        return true;
+    }
+
+    const Ruleset *rules = getRuleset(BOX_SIZE, stats->variant);
+    for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+        int value = save->solutionBoard[i / BOARD_SIZE][i % BOARD_SIZE];
+        if(value == SPACE_VAL){
+            snprintf(detail, size, "solution board isn't complete");
+            return true;
+        }
+        cells[i] = value;
+    }
+    if(initSolver(&solver, rules, cells)){
+        snprintf(detail, size, "solution breaks the %s rules", VARIANT_NAMES[stats->variant - Classic]);
+        return true;
+    }
+
+    int numFilled = 0;
+    int numWrong = 0;
+    for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++){
+        int value = save->board[i / BOARD_SIZE][i % BOARD_SIZE];
+        cells[i] = value == SPACE_VAL ? 0 : value;
+        numFilled += cells[i] != 0;
+        numWrong += cells[i] != 0 && cells[i] != save->solutionBoard[i / BOARD_SIZE][i % BOARD_SIZE];
+    }
+    bool clashes = initSolver(&solver, rules, cells);
+
+    snprintf(detail, size, "%s, %s, %d/%d filled, %d wrong%s", save->binary ? "binary" : "text",
+        VARIANT_NAMES[stats->variant - Classic], numFilled, BOARD_SIZE * BOARD_SIZE, numWrong,
+        clashes ? ", squares clash" : "");
+    return false;
+}
+
+// Verify one save and, when migrating, rewrite a valid text save in the
+// binary format. The new file is written beside the old one and renamed
+// over it so an interrupted run never leaves a half written save
+void processSave(SaveScan *scan, SaveReport *report){
+    char path[PATH_MAX];
+    SaveFile save;
+
+    snprintf(path, sizeof(path), "%s/%s", scan->dir, report->name);
+    if(readSaveFile(path, &save)){
+        report->result = Save_Invalid;
+        snprintf(report->detail, sizeof(report->detail), "%s", save.error);
+        return;
+    }
+
+    report->bytesRead = save.size;
+    if(checkSave(&save, report->detail, sizeof(report->detail))){
+        report->result = Save_Invalid;
+    }else if(!scan->migrate || save.binary){
+        report->result = Save_Valid;
+    }else{
+        char tempPath[PATH_MAX];
+        unsigned char bytes[SAVE_BINARY_SIZE];
+        snprintf(tempPath, sizeof(tempPath), "%s/.%s.migrating", scan->dir, report->name);
+        packSave(save.board, save.solutionBoard, &save.stats, save.stats.elapsedTime, bytes);
+
+        FILE *fp = fopen(tempPath, "wb");
+        bool failed = fp == null;
+        if(!failed){
+            failed = fwrite(bytes, 1, SAVE_BINARY_SIZE, fp) != SAVE_BINARY_SIZE;
+            failed |= fclose(fp) != 0;
+            failed = failed || rename(tempPath, path) != 0;
+            if(failed)
+                unlink(tempPath);
+        }
+
+        size_t length = strlen(report->detail);
+        if(failed){
+            report->result = Save_Failed;
+            snprintf(report->detail + length, sizeof(report->detail) - length, ", can't write: %s", strerror(errno));
+        }else{
+            report->result = Save_Migrated;
+            report->bytesWritten = SAVE_BINARY_SIZE;
+            snprintf(report->detail + length, sizeof(report->detail) - length, ", %ld -> %d bytes",
+                report->bytesRead, SAVE_BINARY_SIZE);
+        }
+    }
+
+    freeBoard(save.board);
+    freeBoard(save.solutionBoard);
+}
+
+void *saveWorkerMain(void *arg){
+    SaveScan *scan = arg;
+    while(true){
+        int next = atomic_fetch_add_explicit(&scan->next, 1, memory_order_relaxed);
+        if(next >= scan->numReports)
+            break;
+        processSave(scan, &scan->reports[next]);
+    }
+    return null;
+}
+
+int compareSaveReports(const void *a, const void *b){
+    return strcmp(((const SaveReport *)a)->name, ((const SaveReport *)b)->name);
+}
+
+// List the regular files in a directory, skipping hidden ones, which
+// includes the temporary files left by an interrupted migration
+bool listSaves(SaveScan *scan){
+    DIR *dir = opendir(scan->dir);
+    if(dir == null)
+        return true;
+
+    int capacity = 0;
+    struct dirent *entry;
+    while((entry = readdir(dir)) != null){
+        if(entry->d_name[0] == '.')
+            continue;
+
+        if(entry->d_type == DT_UNKNOWN){
+            char path[PATH_MAX];
+            struct stat fileStat;
+            snprintf(path, sizeof(path), "%s/%s", scan->dir, entry->d_name);
+            if(stat(path, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+                continue;
+        }else if(entry->d_type != DT_REG){
+            continue;
+        }
+
+        if(scan->numReports == capacity){
+            capacity = capacity == 0 ? 256 : capacity * 2;
+            scan->reports = realloc(scan->reports, sizeof(SaveReport) * capacity);
+        }
+        memset(&scan->reports[scan->numReports], 0, sizeof(SaveReport));
+        scan->reports[scan->numReports++].name = strdup(entry->d_name);
+    }
+
+    closedir(dir);
+    qsort(scan->reports, scan->numReports, sizeof(SaveReport), compareSaveReports);
+    return false;
+}
+
+// cdoku saves verify|migrate [-t THREADS] DIR
+// Checks every save in a directory, or checks them and converts the text
+// saves to the binary format, spreading the files over THREADS threads
+int runSaves(int argc, char **argv){
+    const char *RESULT_NAMES[] = {"ok", "invalid", "migrated", "failed"};
+    int numThreads = defaultThreadCount();
+    SaveScan scan;
+
+    memset(&scan, 0, sizeof(SaveScan));
+    if(argc < 2)
+        return 1;
+    if(strcmp(argv[0], "migrate") == 0)
+        scan.migrate = true;
+    else if(strcmp(argv[0], "verify") != 0)
+        return 1;
+
+    int first = 1;
+    if(argc == 4 && strcmp(argv[1], "-t") == 0){
+        numThreads = atoi(argv[2]);
+        first = 3;
+    }
+    if(first != argc - 1)
+        return 1;
+    scan.dir = argv[first];
+
+    if(listSaves(&scan)){
+        perror(scan.dir);
+        return COMMAND_FAILED;
+    }
+    if(numThreads < 1)
+        numThreads = 1;
+    if(numThreads > scan.numReports)
+        numThreads = scan.numReports > 0 ? scan.numReports : 1;
+
+    double start = nowSeconds();
+    pthread_t *threads = malloc(sizeof(pthread_t) * numThreads);
+    for(int i = 0; i < numThreads; i++){
+        pthread_create(&threads[i], null, saveWorkerMain, &scan);
+    }
+    for(int i = 0; i < numThreads; i++){
+        pthread_join(threads[i], null);
+    }
+    double elapsed = nowSeconds() - start;
+
+    long counts[4] = {0};
+    long bytesRead = 0;
+    long bytesMigrated = 0;
+    long bytesWritten = 0;
+    for(int i = 0; i < scan.numReports; i++){
+        SaveReport *report = &scan.reports[i];
+        printf("%s: %s (%s)\n", report->name, RESULT_NAMES[report->result], report->detail);
+        counts[report->result]++;
+        bytesRead += report->bytesRead;
+        if(report->result == Save_Migrated)
+            bytesMigrated += report->bytesRead;
+        bytesWritten += report->bytesWritten;
+        free(report->name);
+    }
+
+    printf("\n%d files on %d threads in %.3f s (%.0f files/s, %.2f MB/s read)\n", scan.numReports, numThreads,
+        elapsed, scan.numReports / elapsed, bytesRead / elapsed / 1e6);
+    printf("ok: %ld, invalid: %ld", counts[Save_Valid], counts[Save_Invalid]);
+    if(scan.migrate)
+        printf(", migrated: %ld (%ld -> %ld bytes), failed: %ld", counts[Save_Migrated],
+            bytesMigrated, bytesWritten, counts[Save_Failed]);
+    printf("\n");
+
+    free(threads);
+    free(scan.reports);
+    return 0;
+}
+
+const SubCommand SUB_COMMANDS[] = {
+    {"count", runCount, "count [-t THREADS] [-l LIMIT] [-r VARIANT] [PUZZLE...]"},
+    {"bench", runBench, "bench count|notes [PUZZLE] | bench minimal [SYMMETRY] | bench variants"},
+    {"generate", runGenerate, "generate [-n COUNT] [-s none|rotational|mirror] [-r VARIANT] [-t THREADS]"},
+    {"serve", runServe, "serve [-p POOL_SIZE] PATH|[HOST]:PORT"},
+    {"loadgen", runLoadgen, "loadgen [-c CLIENTS] [-n COMMANDS] PATH|[HOST]:PORT"},
+    {"simulate", runSimulate, "simulate [-b BOTS] [-g GAMES] [-t THREADS] [-m CORRECT,MISTAKE,HINT] [-s SAVE_EVERY] [-o DIR]"},
+    {"pack", runPack, "pack [-r VARIANT] [IN [OUT]]"},
+    {"unpack", runUnpack, "unpack [-n NUMBER] [IN [OUT]]"},
+    {"saves", runSaves, "saves verify|migrate [-t THREADS] DIR"}
+};
+int NUM_SUB_COMMANDS = sizeof(SUB_COMMANDS) / sizeof(SUB_COMMANDS[0]);
+
+// Run a non-interactive command given on the command line
+int runSubCommand(int argc, char **argv){
+    for(int i = 0; i < NUM_SUB_COMMANDS; i++){
+        if(strcmp(argv[1], SUB_COMMANDS[i].name) != 0)
+            continue;
+
+        // 1 means the arguments were wrong. Commands that ran and failed
+        // return COMMAND_FAILED after saying why
+        int result = SUB_COMMANDS[i].run(argc - 2, argv + 2);
+        if(result == 1)
+            fprintf(stderr, "usage: %s %s\n", argv[0], SUB_COMMANDS[i].usage);
+        return result;
+    }
+
+    fprintf(stderr, "usage:\n");
+    for(int i = 0; i < NUM_SUB_COMMANDS; i++){
+        fprintf(stderr, "\t%s %s\n", argv[0], SUB_COMMANDS[i].usage);
+    }
+    return 1;
+}
+
+int main(int argc, char **argv){
+    srand((unsigned) time(null));
+    gameSeed = rand();
+    pthread_once(&rulesetsOnce, initRulesets);
+
+    if(argc > 1)
+        return runSubCommand(argc, argv);
+
+    Speculation speculations[DIFFICULTY_MENU_SIZE];
+    memset(speculations, 0, sizeof(speculations));
+    recordScores = true;
+
+    while(true){
+        // Boards for every difficulty are generated while the player reads
+        // the menus, so a new game can start right away
+        for(int i = 0; i < DIFFICULTY_MENU_SIZE; i++){
+            startSpeculation(&speculations[i], Easy + i);
+        }
+
+        printf("Welcome to Dylan's Sudoku!\n\n");
+        enum mainEnum listOption = 
+            getListOption(MAIN_MENU_TITLE, MAIN_MENU_OPTIONS, MAIN_MENU_SIZE);
+
+        int **board = null;
+        int **solutionBoard = null;
+        GameStats stats;
+
+        switch(listOption){
+            case NewGame:
+            {
+                printf("\n");
+                enum difficultyEnum difficulty = 
+                    getListOption(DIFFICULTY_MENU_TITLE, DIFFICULTY_MENU_OPTIONS, DIFFICULTY_MENU_SIZE);
+                printf("\n");
+                enum variantEnum variant =
+                    getListOption(VARIANT_MENU_TITLE, VARIANT_MENU_OPTIONS, VARIANT_MENU_SIZE);
+
+                // Only classic boards are generated ahead of time
+                if(variant == Classic){
+                    board = adoptSpeculation(&speculations[difficulty - Easy], difficulty, &solutionBoard);
+                }else{
+                    currentRules = getRuleset(BOX_SIZE, variant);
+                    board = generateVariantBoard(difficulty, currentRules, &solutionBoard);
+                }
+
+                initStats(&stats, difficulty);
+                stats.variant = variant;
+                char junk[256];
+                // Clear stdin buffer
+                fgets(junk, 256, stdin);
+                play(board, solutionBoard, &stats);
+                freeBoard(board);
+                freeBoard(solutionBoard);
+                free(stats.notes);
+                break;
+            }
+            case LoadGame:
+            {
+                bool loadOkay = !loadGame(&board, &solutionBoard, &stats);
+                if(loadOkay){
+                    currentRules = getRuleset(BOX_SIZE, stats.variant);
+                    play(board, solutionBoard, &stats);
+                }else{
+                    printf("\n\nInvalid or nonexistent file.\n\n");
+                }
+
+                freeBoard(board);
+                freeBoard(solutionBoard);
+                free(stats.notes);
+                break;
+            }
+            case LoadPuzzle:
+            {
+                bool loadOkay = !loadPuzzle(&board, &solutionBoard, &stats);
+                if(loadOkay){
+                    currentRules = getRuleset(BOX_SIZE, stats.variant);
+                    play(board, solutionBoard, &stats);
+                }else{
+                    printf("\n\nInvalid or nonexistent puzzle.\n\n");
+                }
+
+                freeBoard(board);
+                freeBoard(solutionBoard);
+                free(stats.notes);
+                break;
+            }
+            case HighScores:
+                showHighScores();
+                break;
+            case Exit:
+                for(int i = 0; i < DIFFICULTY_MENU_SIZE; i++){
+                    cancelSpeculation(&speculations[i]);
+                }
                 exit(0);
         }
 
+        currentRules = null;
         printf("\n");
     }
 